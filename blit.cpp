@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLIT_SSE2
+#endif
+
+#include "blit.h"
+
+namespace
+{
+  using pixel_helper::color;
+  static_assert(sizeof(color) == 4, "a pixel is one 32-bit lane");
+
+  constexpr int max_expanded_mip_level = 8;
+
+  // writes every one of n source pixels as 1 << MipLevel destination pixels
+  template<int MipLevel>
+  void expand_squares(color *dst, const color *src, int n)
+  {
+    constexpr int sq_size = 1 << MipLevel;
+    if constexpr (MipLevel == 0)
+      std::memcpy(dst, src, n * sizeof(color));
+#if defined(BLIT_SSE2)
+    else if constexpr (sq_size >= 4)
+      for (int i = 0; i < n; i++)
+      {
+        const __m128i v = _mm_set1_epi32(static_cast<int>(src[i].argb));
+        auto *out = reinterpret_cast<__m128i *>(dst + i * sq_size);
+        for (int k = 0; k < sq_size / 4; k++)
+          _mm_storeu_si128(out + k, v);
+      }
+#endif
+    else
+      for (int i = 0; i < n; i++)
+        for (int k = 0; k < sq_size; k++)
+          dst[i * sq_size + k] = src[i];
+  }
+
+  template<int... MipLevels>
+  constexpr auto make_expanders(std::integer_sequence<int, MipLevels...>)
+  {
+    using expander = void (*)(color *, const color *, int);
+    return std::array<expander, sizeof...(MipLevels)>{&expand_squares<MipLevels>...};
+  }
+
+  constexpr auto expanders = make_expanders(std::make_integer_sequence<int, max_expanded_mip_level + 1>());
+
+  void expand(color *dst, const color *src, int n, int mip_level)
+  {
+    if (mip_level <= max_expanded_mip_level)
+      expanders[mip_level](dst, src, n);
+    else
+      for (int i = 0; i < n; i++)
+        std::fill_n(dst + (size_t(i) << mip_level), size_t(1) << mip_level, src[i]);
+  }
+
+  // screen rectangle [x0, x1) x [y0, y1) of b inside the screen rows [band_y0, band_y1)
+  struct clip_rect
+  {
+    int x0, x1, y0, y1;
+
+    bool is_empty() const
+    {
+      return x0 >= x1 || y0 >= y1;
+    }
+  };
+
+  clip_rect clip(const mip_blit &b, int scr_w, int band_y0, int band_y1)
+  {
+    const int sq_size = 1 << b.mip_level;
+    return {std::max(b.scr_x, 0), std::min(b.scr_x + b.mip_w * sq_size, scr_w), std::max(b.scr_y, band_y0),
+            std::min(b.scr_y + b.mip_h * sq_size, band_y1)};
+  }
+
+  // draws b into the screen rows [band_y0, band_y1)
+  void draw_band(color *scr, int scr_w, int band_y0, int band_y1, const mip_blit &b)
+  {
+    const clip_rect r = clip(b, scr_w, band_y0, band_y1);
+    if (r.is_empty())
+      return;
+
+    // visible source columns, the squares of the first and the last one can be cut by the clip
+    const int mip_level = b.mip_level, sq_size = 1 << mip_level;
+    const int first_col = (r.x0 - b.scr_x) >> mip_level, last_col = (r.x1 - 1 - b.scr_x) >> mip_level;
+    const int first_x = b.scr_x + (first_col << mip_level), last_x = b.scr_x + (last_col << mip_level);
+    const int full_begin = first_x < r.x0 ? first_col + 1 : first_col;
+    const int full_end = last_x + sq_size > r.x1 ? last_col : last_col + 1;
+    const size_t row_bytes = (r.x1 - r.x0) * sizeof(color);
+
+    for (int y = r.y0; y < r.y1;)
+    {
+      const int row = (y - b.scr_y) >> mip_level;
+      const int row_end = std::min(b.scr_y + ((row + 1) << mip_level), r.y1);
+      const color *src = b.data + row * b.mip_w;
+      color *line = scr + size_t(y) * scr_w;
+
+      if (full_begin > full_end)
+        // one square cut on both sides
+        std::fill(line + r.x0, line + r.x1, src[first_col]);
+      else
+      {
+        if (full_begin != first_col)
+          std::fill(line + r.x0, line + first_x + sq_size, src[first_col]);
+        expand(line + b.scr_x + (full_begin << mip_level), src + full_begin, full_end - full_begin, mip_level);
+        if (full_end != last_col + 1)
+          std::fill(line + last_x, line + r.x1, src[last_col]);
+      }
+
+      // the other screen rows of the squares are the same
+      for (int k = y + 1; k < row_end; k++)
+        std::memcpy(scr + size_t(k) * scr_w + r.x0, line + r.x0, row_bytes);
+      y = row_end;
+    }
+  }
+}  // namespace
+
+void draw_mip(std::vector<pixel_helper::color> &scr_buf, int scr_w, int scr_h,
+              const pixel_helper::color *data, int scr_x, int scr_y, int mip_w, int mip_h, int mip_level)
+{
+  draw_band(scr_buf.data(), scr_w, 0, scr_h, {data, scr_x, scr_y, mip_w, mip_h, mip_level});
+}
+
+blit_workers::blit_workers(unsigned n_threads) : n_threads(std::max(n_threads, 1u))
+{
+  for (unsigned i = 1; i < this->n_threads; i++)
+    threads.emplace_back([this, band = static_cast<int>(i)] {
+      uint64_t seen = 0;
+      for (;;)
+      {
+        std::unique_lock lg(m);
+        cv.wait(lg, [&] { return is_quit || generation != seen; });
+        if (is_quit)
+          return;
+        seen = generation;
+        if (band >= task_bands)
+          continue;
+        const std::function<void(int)> &draw = *task;
+        lg.unlock();
+        draw(band);
+        lg.lock();
+        if (--remaining == 0)
+          done_cv.notify_one();
+      }
+    });
+}
+
+blit_workers::~blit_workers()
+{
+  {
+    std::lock_guard lg(m);
+    is_quit = true;
+  }
+  cv.notify_all();
+  for (auto &th : threads)
+    th.join();
+}
+
+void blit_workers::run(int n_bands, const std::function<void(int)> &draw)
+{
+  {
+    std::lock_guard lg(m);
+    task = &draw;
+    task_bands = n_bands;
+    remaining = n_bands - 1;
+    generation++;
+  }
+  if (n_bands > 1)
+    cv.notify_all();
+  draw(0);
+  std::unique_lock lg(m);
+  done_cv.wait(lg, [this] { return remaining == 0; });
+}
+
+void draw_mips(std::vector<pixel_helper::color> &scr_buf, int scr_w, int scr_h, const std::vector<mip_blit> &blits,
+               blit_workers *workers)
+{
+  size_t pixels = 0;
+  for (const mip_blit &b : blits)
+  {
+    clip_rect r = clip(b, scr_w, 0, scr_h);
+    if (!r.is_empty())
+      pixels += size_t(r.x1 - r.x0) * (r.y1 - r.y0);
+  }
+  if (pixels == 0)
+    return;
+
+  const int n_bands = workers == nullptr || pixels < parallel_blit_pixels
+                          ? 1
+                          : static_cast<int>(std::min<unsigned>(workers->get_n_threads(), scr_h));
+  auto draw = [&](int band) {
+    const int band_y0 = scr_h * band / n_bands, band_y1 = scr_h * (band + 1) / n_bands;
+    for (const mip_blit &b : blits)
+      draw_band(scr_buf.data(), scr_w, band_y0, band_y1, b);
+  };
+
+  if (n_bands == 1)
+    draw(0);
+  else
+    workers->run(n_bands, draw);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "superpixel.h"
+
+/* Draws mip_w x mip_h pixels of a mip level at (scr_x, scr_y) of the screen buffer, clipped to it,
+ * every pixel as a square of (1 << mip_level) screen pixels.
+ * Clips once, expands every visible source row once and copies it to the other screen rows of its squares.
+ * Works faster and more stably than QPainter::drawImage(QRect dst, QImage, QRect src) */
+void draw_mip(std::vector<pixel_helper::color> &scr_buf, int scr_w, int scr_h,
+              const pixel_helper::color *data, int scr_x, int scr_y, int mip_w, int mip_h, int mip_level);
+
+/* Mip level to draw with draw_mips */
+struct mip_blit
+{
+  const pixel_helper::color *data;
+  int scr_x, scr_y, mip_w, mip_h, mip_level;
+};
+
+// minimal screen pixels covered by a batch to split it across threads
+constexpr size_t parallel_blit_pixels = size_t(1) << 20;
+
+/* Threads kept for draw_mips, so a batch does not start and join threads of its own.
+ * The calling thread draws a band itself and waits for the others */
+class blit_workers
+{
+public:
+  explicit blit_workers(unsigned n_threads);  // the calling thread counts as one
+  blit_workers(const blit_workers &) = delete;
+  blit_workers &operator=(const blit_workers &) = delete;
+  ~blit_workers();
+
+  unsigned get_n_threads() const
+  {
+    return n_threads;
+  }
+
+  // draw(band) for the bands [0, n_bands), band 0 on the calling thread; pre: n_bands <= get_n_threads()
+  void run(int n_bands, const std::function<void(int)> &draw);
+
+private:
+  const unsigned n_threads;
+  std::mutex m;
+  std::condition_variable cv, done_cv;
+  const std::function<void(int)> *task = nullptr;
+  int task_bands = 0;
+  uint64_t generation = 0;  // of the task
+  int remaining = 0;        // bands of other threads not drawn
+  bool is_quit = false;
+  std::vector<std::thread> threads;  // thread i draws band i + 1
+};
+
+/* Draws blits in order (later ones over earlier ones), as draw_mip.
+ * Batches covering at least parallel_blit_pixels are split into horizontal bands of the screen drawn by
+ * workers (all on the calling thread without them), every band draws all blits clipped to it */
+void draw_mips(std::vector<pixel_helper::color> &scr_buf, int scr_w, int scr_h, const std::vector<mip_blit> &blits,
+               blit_workers *workers = nullptr);
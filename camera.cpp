@@ -4,16 +4,24 @@
 
 bool camera::zoom(QPointF mposf, int delta)
 {
-  qreal fac = pow(ZOOM_FACTOR, delta);
-  if (get_pixel_scale() * fac < MIN_PIXEL_SCALE)
-    fac = MIN_PIXEL_SCALE / get_pixel_scale();
-  if (fac == 1)
+  int new_zoom_level = zoom_level + delta;
+  while (new_zoom_level > zoom_level && level_pixel_scale(new_zoom_level) < MIN_PIXEL_SCALE)
+    new_zoom_level--;
+  if (new_zoom_level == zoom_level)
     return false;
+  qreal fac = level_pixel_scale(new_zoom_level) / get_pixel_scale();
+  zoom_level = new_zoom_level;
 
   QSizeF size = screen.size();
   screen.moveTopLeft({screen.left() + (1 - fac) * screen.width() * mposf.x(),
                       screen.top() + (1 - fac) * screen.height() * mposf.y()});
   screen.setSize(size * fac);
+
+  // keep screen coordinates small relative to pixel scale
+  QPointF center = screen.center();
+  origin_x += center.x();
+  origin_y += center.y();
+  screen.moveCenter({0, 0});
   return true;
 }
 
@@ -31,7 +39,14 @@ void camera::resize(QSize size)
 
 qreal camera::get_pixel_scale() const
 {
-  return screen.width() / img_size.width();
+  return level_pixel_scale(zoom_level);
+}
+
+qreal camera::level_pixel_scale(int zoom_level)
+{
+  int octave = zoom_level >= 0 ? zoom_level / LEVELS_PER_OCTAVE : -((LEVELS_PER_OCTAVE - 1 - zoom_level) / LEVELS_PER_OCTAVE);
+  int step = zoom_level - octave * LEVELS_PER_OCTAVE;
+  return std::ldexp(BASE_PIXEL_SCALE * std::exp2(-step * 1.0 / LEVELS_PER_OCTAVE), -octave);
 }
 
 QPointF camera::to_point(int x, int y) const
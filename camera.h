@@ -3,8 +3,15 @@
 #include <ratio>
 #include <QRect>
 
+#include "double_double.h"
+
 struct camera
 {
+  // double-double point the screen is measured from, moved to the screen center on every zoom,
+  // so deep kernel tiers get the full precision of the view position
+  dd_real origin_x = 0, origin_y = 0;
+  // pixel scale is level_pixel_scale(zoom_level): views at the same level share their superpixel grid
+  int zoom_level = 0;
   QRectF screen = QRectF(-2., -2., 4., 4.);
   QSize img_size = QSize(screen.width() * 100, screen.height() * 100);
 
@@ -13,6 +20,7 @@ struct camera
   void resize(QSize size);
 
   qreal get_pixel_scale() const;
+  static qreal level_pixel_scale(int zoom_level);
 
   QPointF to_point(int x, int y) const;
   QPoint from_point(QPointF pt) const;
@@ -31,6 +39,10 @@ struct camera
     return pt_b >= screen.top() - delta && pt_t <= screen.bottom() + delta;
   }
 
-  static constexpr qreal MIN_PIXEL_SCALE = 1e-16;
-  static constexpr qreal ZOOM_FACTOR = 0.8;
+  static constexpr qreal BASE_PIXEL_SCALE = 0.01;  // initial screen: 4 units wide, 400 pixels
+  // limited by double-double reference orbit precision
+  static constexpr qreal MIN_PIXEL_SCALE = 1e-28;
+  // zoom step is 2^(-1 / LEVELS_PER_OCTAVE) (about 0.8), so every LEVELS_PER_OCTAVE levels the pixel scale halves
+  // exactly and superpixel grids nest as a quadtree
+  static constexpr int LEVELS_PER_OCTAVE = 3;
 };
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/* Checksums of file formats, continued over several buffers by passing the previous result */
+namespace checksum
+{
+  // CRC-32 (ISO-HDLC, as in zlib and PNG), starts from 0
+  inline uint32_t crc32(uint32_t crc, const void *data, size_t bytes)
+  {
+    static const std::array<uint32_t, 256> table = [] {
+      std::array<uint32_t, 256> res;
+      for (uint32_t i = 0; i < 256; i++)
+      {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+          c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        res[i] = c;
+      }
+      return res;
+    }();
+
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < bytes; i++)
+      crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+  }
+
+  // Adler-32 (zlib stream trailer), starts from 1
+  inline uint32_t adler32(uint32_t adler, const void *data, size_t bytes)
+  {
+    constexpr uint32_t mod = 65521;
+    constexpr size_t max_run = 5552;  // bytes summed before the sums can overflow
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (bytes > 0)
+    {
+      size_t run = bytes < max_run ? bytes : max_run;
+      bytes -= run;
+      for (; run > 0; run--)
+      {
+        a += *p++;
+        b += a;
+      }
+      a %= mod;
+      b %= mod;
+    }
+    return b << 16 | a;
+  }
+}  // namespace checksum
@@ -0,0 +1,92 @@
+#pragma once
+
+/* Unevaluated sum of two doubles (hi + lo, |lo| <= ulp(hi) / 2) giving ~106 bits of mantissa.
+ * Uses error-free transformations (Knuth two-sum, Dekker split product), so no FMA is required. */
+struct dd_real
+{
+  double hi = 0, lo = 0;
+
+  constexpr dd_real() = default;
+  constexpr dd_real(double x) noexcept : hi(x) {}
+  constexpr dd_real(double hi, double lo) noexcept : hi(hi), lo(lo) {}
+
+  explicit operator double() const noexcept
+  {
+    return hi + lo;
+  }
+
+  static dd_real two_sum(double a, double b) noexcept
+  {
+    double s = a + b;
+    double bb = s - a;
+    return {s, (a - (s - bb)) + (b - bb)};
+  }
+
+  static dd_real quick_two_sum(double a, double b) noexcept
+  {
+    double s = a + b;
+    return {s, b - (s - a)};
+  }
+
+  static dd_real two_prod(double a, double b) noexcept
+  {
+    constexpr double splitter = 134217729.0;  // 2^27 + 1
+    double p = a * b;
+    double ta = splitter * a, tb = splitter * b;
+    double a_hi = ta - (ta - a), a_lo = a - a_hi;
+    double b_hi = tb - (tb - b), b_lo = b - b_hi;
+    return {p, ((a_hi * b_hi - p) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo};
+  }
+
+  friend dd_real operator+(dd_real a, dd_real b) noexcept
+  {
+    dd_real s = two_sum(a.hi, b.hi), t = two_sum(a.lo, b.lo);
+    s.lo += t.hi;
+    s = quick_two_sum(s.hi, s.lo);
+    s.lo += t.lo;
+    return quick_two_sum(s.hi, s.lo);
+  }
+
+  friend dd_real operator-(dd_real a) noexcept
+  {
+    return {-a.hi, -a.lo};
+  }
+
+  friend dd_real operator-(dd_real a, dd_real b) noexcept
+  {
+    return a + -b;
+  }
+
+  friend dd_real operator*(dd_real a, dd_real b) noexcept
+  {
+    dd_real p = two_prod(a.hi, b.hi);
+    p.lo += a.hi * b.lo + a.lo * b.hi;
+    return quick_two_sum(p.hi, p.lo);
+  }
+
+  // long division: each quotient digit corrects the remainder of the previous ones
+  friend dd_real operator/(dd_real a, dd_real b) noexcept
+  {
+    double q1 = a.hi / b.hi;
+    dd_real r = a - b * dd_real(q1);
+    double q2 = r.hi / b.hi;
+    r -= b * dd_real(q2);
+    double q3 = r.hi / b.hi;
+    return quick_two_sum(q1, q2) + dd_real(q3);
+  }
+
+  dd_real &operator+=(dd_real b) noexcept
+  {
+    return *this = *this + b;
+  }
+
+  dd_real &operator-=(dd_real b) noexcept
+  {
+    return *this = *this - b;
+  }
+
+  dd_real &operator*=(dd_real b) noexcept
+  {
+    return *this = *this * b;
+  }
+};
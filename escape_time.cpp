@@ -0,0 +1,223 @@
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ESCAPE_TIME_SSE2
+#endif
+
+#include "escape_time.h"
+
+float escape_time::calc(std::complex<qreal> c, const settings &s, qreal tolerance, shortcut_counts &counts)
+{
+  if (in_cardioid_or_bulb(c.real(), c.imag()))
+  {
+    counts.cardioid_bulb++;
+    return static_cast<float>(s.max_iterations);
+  }
+
+  const qreal tolerance2 = tolerance * tolerance;
+  int check_period = 1, check_steps = 0;
+  std::complex<qreal> z = c, check = z;
+  for (int n = 0; n < s.max_iterations; n++)
+  {
+    if (!(std::norm(z) < 4))
+      return escaped_value(n, std::norm(z), s);
+    z = z * z + c;
+    if (std::norm(z - check) < tolerance2)
+    {
+      counts.periodic++;
+      return static_cast<float>(s.max_iterations);
+    }
+    if (++check_steps == check_period)
+    {
+      check = z;
+      check_steps = 0;
+      check_period *= 2;
+    }
+  }
+  return static_cast<float>(s.max_iterations);
+}
+
+namespace
+{
+#if defined(__AVX2__)
+  struct vec_ops
+  {
+    using vec = __m256d;
+    static constexpr size_t width = 4;
+
+    static vec set1(double x) { return _mm256_set1_pd(x); }
+    static vec ones() { return _mm256_castsi256_pd(_mm256_set1_epi64x(-1)); }
+    static vec lanes() { return _mm256_set_pd(3, 2, 1, 0); }
+    static vec add(vec a, vec b) { return _mm256_add_pd(a, b); }
+    static vec sub(vec a, vec b) { return _mm256_sub_pd(a, b); }
+    static vec mul(vec a, vec b) { return _mm256_mul_pd(a, b); }
+    static vec and_(vec a, vec b) { return _mm256_and_pd(a, b); }
+    static vec or_(vec a, vec b) { return _mm256_or_pd(a, b); }
+    static vec andnot(vec a, vec b) { return _mm256_andnot_pd(a, b); }
+    static vec less(vec a, vec b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static vec less_equal(vec a, vec b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+    static int mask(vec a) { return _mm256_movemask_pd(a); }
+    static void store(double *dst, vec a) { _mm256_storeu_pd(dst, a); }
+  };
+#elif defined(ESCAPE_TIME_SSE2)
+  struct vec_ops
+  {
+    using vec = __m128d;
+    static constexpr size_t width = 2;
+
+    static vec set1(double x) { return _mm_set1_pd(x); }
+    static vec ones() { return _mm_castsi128_pd(_mm_set1_epi32(-1)); }
+    static vec lanes() { return _mm_set_pd(1, 0); }
+    static vec add(vec a, vec b) { return _mm_add_pd(a, b); }
+    static vec sub(vec a, vec b) { return _mm_sub_pd(a, b); }
+    static vec mul(vec a, vec b) { return _mm_mul_pd(a, b); }
+    static vec and_(vec a, vec b) { return _mm_and_pd(a, b); }
+    static vec or_(vec a, vec b) { return _mm_or_pd(a, b); }
+    static vec andnot(vec a, vec b) { return _mm_andnot_pd(a, b); }
+    static vec less(vec a, vec b) { return _mm_cmplt_pd(a, b); }
+    static vec less_equal(vec a, vec b) { return _mm_cmple_pd(a, b); }
+    static int mask(vec a) { return _mm_movemask_pd(a); }
+    static void store(double *dst, vec a) { _mm_storeu_pd(dst, a); }
+  };
+#endif
+
+#if defined(__AVX2__) || defined(ESCAPE_TIME_SSE2)
+  template<class V, bool Smooth>
+  struct lane_group
+  {
+    using vec = typename V::vec;
+    vec cr, ci, zr, zi, check_r, check_i, n, active, periodic, escape_norm;
+
+    // interior mask of main cardioid and period-2 bulb
+    static vec in_cardioid_or_bulb(vec x, vec y)
+    {
+      const vec quarter = V::set1(0.25), one = V::set1(1), sixteenth = V::set1(0.0625);
+      vec y2 = V::mul(y, y), xq = V::sub(x, quarter), q = V::add(V::mul(xq, xq), y2);
+      vec x1 = V::add(x, one);
+      return V::or_(V::less_equal(V::mul(q, V::add(q, xq)), V::mul(quarter, y2)),
+                    V::less_equal(V::add(V::mul(x1, x1), y2), sixteenth));
+    }
+
+    lane_group(vec cr, vec ci) : cr(cr), ci(ci), zr(cr), zi(ci), check_r(cr), check_i(ci), n(V::set1(0))
+    {
+      periodic = escape_norm = V::set1(0);
+      active = V::andnot(in_cardioid_or_bulb(cr, ci), V::ones());
+    }
+
+    // one iteration; returns false if every lane is done
+    bool step(vec tolerance2)
+    {
+      const vec four = V::set1(4), one = V::set1(1);
+      vec zr_2 = V::mul(zr, zr), zi_2 = V::mul(zi, zi), norm = V::add(zr_2, zi_2);
+      vec inside = V::less(norm, four);
+      if constexpr (Smooth)
+        escape_norm = V::or_(escape_norm, V::and_(V::andnot(inside, active), norm));
+      active = V::and_(active, inside);
+      if (V::mask(active) == 0)
+        return false;
+      n = V::add(n, V::and_(active, one));
+
+      vec zri = V::mul(zr, zi);
+      zr = V::add(V::sub(zr_2, zi_2), cr);
+      zi = V::add(V::add(zri, zri), ci);
+
+      vec dr = V::sub(zr, check_r), di = V::sub(zi, check_i);
+      vec close = V::and_(active, V::less(V::add(V::mul(dr, dr), V::mul(di, di)), tolerance2));
+      periodic = V::or_(periodic, close);
+      active = V::andnot(close, active);
+      return true;
+    }
+
+    void save_check()
+    {
+      check_r = zr;
+      check_i = zi;
+    }
+  };
+
+  /* Iterates two registers of points at once (8 lanes with AVX2, 4 with SSE2).
+   * Lanes leave the active mask once they escape or are found periodic,
+   * and the loop exits as soon as no lane is active. */
+  template<class V, bool Smooth>
+  void calc_group(float *out, QPointF start, QPointF step, const escape_time::settings &s, qreal tolerance,
+                  escape_time::shortcut_counts &counts)
+  {
+    using vec = typename V::vec;
+    const vec step_x = V::set1(step.x()), step_y = V::set1(step.y());
+    const vec idx0 = V::lanes(), idx1 = V::add(idx0, V::set1(V::width));
+    const vec tolerance2 = V::set1(tolerance * tolerance);
+
+    lane_group<V, Smooth> g0(V::add(V::set1(start.x()), V::mul(idx0, step_x)), V::add(V::set1(start.y()), V::mul(idx0, step_y)));
+    lane_group<V, Smooth> g1(V::add(V::set1(start.x()), V::mul(idx1, step_x)), V::add(V::set1(start.y()), V::mul(idx1, step_y)));
+    const int interior0 = ~V::mask(g0.active), interior1 = ~V::mask(g1.active);
+
+    for (int n = 0, check_period = 1, check_steps = 0; n < s.max_iterations; n++)
+    {
+      bool is_active0 = g0.step(tolerance2), is_active1 = g1.step(tolerance2);
+      if (!is_active0 && !is_active1)
+        break;
+      if (++check_steps == check_period)
+      {
+        g0.save_check();
+        g1.save_check();
+        check_steps = 0;
+        check_period *= 2;
+      }
+    }
+
+    double res[2 * V::width], norm[2 * V::width];
+    V::store(res, g0.n);
+    V::store(res + V::width, g1.n);
+    V::store(norm, g0.escape_norm);
+    V::store(norm + V::width, g1.escape_norm);
+    const int periodic = V::mask(g0.periodic) | V::mask(g1.periodic) << V::width;
+    const int cardioid_bulb = (interior0 & ((1 << V::width) - 1)) | (interior1 & ((1 << V::width) - 1)) << V::width;
+    for (size_t i = 0; i < 2 * V::width; i++)
+    {
+      int n = static_cast<int>(res[i]);
+      if ((cardioid_bulb | periodic) >> i & 1)
+      {
+        out[i] = static_cast<float>(s.max_iterations);
+        counts.cardioid_bulb += cardioid_bulb >> i & 1;
+        counts.periodic += periodic >> i & 1;
+      }
+      else if (n == s.max_iterations)
+        out[i] = static_cast<float>(n);
+      else
+        out[i] = escape_time::escaped_value(n, norm[i], s);
+    }
+  }
+#endif
+}  // namespace
+
+void escape_time::calc_row(float *out, QPointF start, QPointF step, size_t count, const settings &s)
+{
+  const qreal tolerance = periodicity_tolerance(step);
+  shortcut_counts counts;
+  size_t i = 0;
+#if defined(__AVX2__) || defined(ESCAPE_TIME_SSE2)
+  auto group = s.smooth ? &calc_group<vec_ops, true> : &calc_group<vec_ops, false>;
+  for (; i + 2 * vec_ops::width <= count; i += 2 * vec_ops::width)
+    group(out + i, start + step * qreal(i), step, s, tolerance, counts);
+#endif
+  for (; i < count; i++)
+  {
+    QPointF pt = start + step * qreal(i);
+    out[i] = calc({pt.x(), pt.y()}, s, tolerance, counts);
+  }
+  counts.flush(count);
+}
+
+void escape_time::calc_row(float *out, dd_real origin_x, dd_real origin_y, QPointF start, QPointF step, size_t count,
+                           const settings &s)
+{
+  const qreal tolerance = periodicity_tolerance(step);
+  shortcut_counts counts;
+  for (size_t i = 0; i < count; i++)
+  {
+    QPointF pt = start + step * qreal(i);
+    out[i] = calc<dd_real>(origin_x + pt.x(), origin_y + pt.y(), s, tolerance, counts);
+  }
+  counts.flush(count);
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <QPointF>
+
+#include "double_double.h"
+#include "perf_stats.h"
+
+/* Escape-time iteration kernels for the Mandelbrot set.
+ * Results are iteration values: the number of iterations before Z = Z * Z + C escapes radius 2,
+ * optionally smoothed by the escape distance, and settings::max_iterations for the set interior.
+ * Points of the set interior are resolved early by:
+ *  - analytic main cardioid and period-2 bulb membership test;
+ *  - Brent-style orbit periodicity detection: the orbit is compared with a point saved
+ *    at iterations 1, 2, 4, 8, ..., and is taken as periodic once it returns within tolerance. */
+namespace escape_time
+{
+  inline constexpr int default_max_iterations = 255;
+
+  struct settings
+  {
+    int max_iterations = default_max_iterations;
+    bool smooth = false;  // continuous iteration values instead of integer ones
+
+    bool operator==(const settings &other) const
+    {
+      return max_iterations == other.max_iterations && smooth == other.smooth;
+    }
+
+    // identifies the computed iteration values apart from max_iterations: Z * Z + C, bit 0 for smoothing
+    uint32_t formula_id() const
+    {
+      return smooth ? 1 : 0;
+    }
+    bool operator!=(const settings &other) const
+    {
+      return !(*this == other);
+    }
+  };
+
+  /* Per-call shortcut counts, flushed to the perf_stats counters once per row */
+  struct shortcut_counts
+  {
+    uint64_t cardioid_bulb = 0, periodic = 0;
+
+    void flush(size_t pixels) const
+    {
+      perf_stats::add(perf_stats::counter::KERNEL_PIXELS, pixels);
+      // exterior rows resolve none
+      if (cardioid_bulb != 0)
+        perf_stats::add(perf_stats::counter::CARDIOID_BULB_PIXELS, cardioid_bulb);
+      if (periodic != 0)
+        perf_stats::add(perf_stats::counter::PERIODIC_PIXELS, periodic);
+    }
+  };
+
+  inline bool in_cardioid_or_bulb(double x, double y)
+  {
+    double y2 = y * y, xq = x - 0.25, q = xq * xq + y2;
+    return q * (q + xq) <= 0.25 * y2 || (x + 1) * (x + 1) + y2 <= 0.0625;
+  }
+
+  // Periodicity tolerance for samples spaced by step: well below a pixel
+  inline qreal periodicity_tolerance(QPointF step)
+  {
+    return std::hypot(step.x(), step.y()) / 1024;
+  }
+
+  // Iteration value of a point escaped after n iterations with |Z|^2 = norm
+  inline float escaped_value(int n, double norm, const settings &s)
+  {
+    if (!s.smooth)
+      return static_cast<float>(n);
+    return std::max(0.f, static_cast<float>(n + 1 - std::log2(0.5 * std::log2(norm))));
+  }
+
+  float calc(std::complex<qreal> c, const settings &s, qreal tolerance, shortcut_counts &counts);
+
+  inline float calc(std::complex<qreal> c, const settings &s = {}, qreal tolerance = 0)
+  {
+    shortcut_counts counts;
+    return calc(c, s, tolerance, counts);
+  }
+
+  // Same iteration for any real type with +, -, * and conversion to double (e.g. dd_real)
+  template<typename T>
+  float calc(T c_x, T c_y, const settings &s, qreal tolerance, shortcut_counts &counts)
+  {
+    if (in_cardioid_or_bulb(static_cast<double>(c_x), static_cast<double>(c_y)))
+    {
+      counts.cardioid_bulb++;
+      return static_cast<float>(s.max_iterations);
+    }
+
+    const double tolerance2 = tolerance * tolerance;
+    T z_x = c_x, z_y = c_y, check_x = z_x, check_y = z_y;
+    int check_period = 1, check_steps = 0;
+    for (int n = 0; n < s.max_iterations; n++)
+    {
+      T z_xx = z_x * z_x, z_yy = z_y * z_y;
+      double norm = static_cast<double>(z_xx + z_yy);
+      if (!(norm < 4))
+        return escaped_value(n, norm, s);
+      T z_xy = z_x * z_y;
+      z_x = z_xx - z_yy + c_x;
+      z_y = z_xy + z_xy + c_y;
+
+      double d_x = static_cast<double>(z_x - check_x), d_y = static_cast<double>(z_y - check_y);
+      if (d_x * d_x + d_y * d_y < tolerance2)
+      {
+        counts.periodic++;
+        return static_cast<float>(s.max_iterations);
+      }
+      if (++check_steps == check_period)
+      {
+        check_x = z_x, check_y = z_y;
+        check_steps = 0;
+        check_period *= 2;
+      }
+    }
+    return static_cast<float>(s.max_iterations);
+  }
+
+  // Fills out[i] = calc(start + i * step) for i in [0, count),
+  // evaluating several points per vector register (AVX2 or SSE2 when available)
+  void calc_row(float *out, QPointF start, QPointF step, size_t count, const settings &s);
+
+  // Fills out[i] = calc(origin + start + i * step) in double-double precision
+  void calc_row(float *out, dd_real origin_x, dd_real origin_y, QPointF start, QPointF step, size_t count,
+                const settings &s);
+}  // namespace escape_time
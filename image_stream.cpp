@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <cstring>
+
+#ifdef MANDELBROT_ZLIB
+#include <zlib.h>
+#endif
+
+#include "checksum.h"
+#include "image_stream.h"
+
+namespace
+{
+  constexpr uchar png_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  constexpr size_t idat_bytes = size_t(1) << 20;  // compressed data buffered per IDAT chunk
+  constexpr uchar filter_sub = 1;                 // each byte minus the same byte of the previous pixel
+
+  void put_u32(std::vector<uchar> &out, uint32_t x)
+  {
+    for (int shift = 24; shift >= 0; shift -= 8)
+      out.push_back(static_cast<uchar>(x >> shift));
+  }
+}  // namespace
+
+struct image_stream::deflater
+{
+#ifdef MANDELBROT_ZLIB
+  z_stream stream{};
+  bool is_ready;
+
+  deflater() : is_ready(deflateInit(&stream, Z_DEFAULT_COMPRESSION) == Z_OK)
+  {
+  }
+  ~deflater()
+  {
+    if (is_ready)
+      deflateEnd(&stream);
+  }
+
+  // zlib's message for the last error, if it set one
+  QString error_string(int code) const
+  {
+    return QString("zlib error %1%2").arg(code).arg(stream.msg ? QString(": ") + stream.msg : QString());
+  }
+#else
+  static constexpr size_t max_stored_block = 0xFFFF;
+  uint32_t adler = 1;
+  bool is_started = false;
+#endif
+  std::vector<uchar> out;  // compressed data of the next IDAT chunk
+};
+
+image_stream::format image_stream::format_of(const QString &path)
+{
+  return path.endsWith(".png", Qt::CaseInsensitive) ? format::PNG : format::PPM;
+}
+
+image_stream::image_stream(const QString &path, int width, int height)
+    : file(path), fmt(format_of(path)), width(width), height(height)
+{
+  ok = file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+  if (!ok)
+  {
+    error = file.errorString();
+    return;
+  }
+
+  scanline.resize(1 + size_t(width) * 3);
+  if (fmt == format::PPM)
+  {
+    QByteArray header = "P6\n" + QByteArray::number(width) + " " + QByteArray::number(height) + "\n255\n";
+    write(header.constData(), header.size());
+    return;
+  }
+
+  z = std::make_unique<deflater>();
+#ifdef MANDELBROT_ZLIB
+  if (!z->is_ready)
+  {
+    ok = false;
+    error = "cannot initialize zlib";
+    return;
+  }
+#endif
+  std::vector<uchar> ihdr;
+  put_u32(ihdr, width);
+  put_u32(ihdr, height);
+  ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});  // 8 bits per channel, RGB, deflate, adaptive filters, no interlace
+  write(png_signature, sizeof(png_signature)) && write_chunk("IHDR", ihdr.data(), ihdr.size());
+}
+
+image_stream::~image_stream() = default;
+
+bool image_stream::write(const void *data, size_t bytes)
+{
+  if (ok && file.write(static_cast<const char *>(data), bytes) != qint64(bytes))
+  {
+    ok = false;
+    error = file.errorString();
+  }
+  return ok;
+}
+
+bool image_stream::write_chunk(const char *type, const uchar *data, size_t bytes)
+{
+  std::vector<uchar> header;
+  put_u32(header, static_cast<uint32_t>(bytes));
+  header.insert(header.end(), type, type + 4);
+  uint32_t crc = checksum::crc32(checksum::crc32(0, type, 4), data, bytes);
+  std::vector<uchar> trailer;
+  put_u32(trailer, crc);
+  return write(header.data(), header.size()) && write(data, bytes) && write(trailer.data(), trailer.size());
+}
+
+bool image_stream::deflate(const uchar *data, size_t bytes, bool last)
+{
+  std::vector<uchar> &out = z->out;
+#ifdef MANDELBROT_ZLIB
+  constexpr size_t step = 64 << 10;
+  z->stream.next_in = const_cast<uchar *>(data);
+  z->stream.avail_in = static_cast<uInt>(bytes);
+  int res;
+  do
+  {
+    size_t used = out.size();
+    out.resize(used + step);
+    z->stream.next_out = out.data() + used;
+    z->stream.avail_out = static_cast<uInt>(step);
+    res = ::deflate(&z->stream, last ? Z_FINISH : Z_NO_FLUSH);
+    out.resize(used + step - z->stream.avail_out);
+    // Z_BUF_ERROR only means no progress was possible with the space given
+    if (res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR)
+      break;
+  } while (z->stream.avail_out == 0);
+  if ((res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR) || (last && res != Z_STREAM_END))
+  {
+    ok = false;
+    error = z->error_string(res);
+    return false;
+  }
+#else
+  if (!z->is_started)
+  {
+    out.insert(out.end(), {0x78, 0x01});  // zlib header: deflate, 32K window, no dictionary
+    z->is_started = true;
+  }
+  z->adler = checksum::adler32(z->adler, data, bytes);
+  for (size_t done = 0; done < bytes || last;)
+  {
+    size_t n = std::min(bytes - done, deflater::max_stored_block);
+    bool is_final = last && done + n == bytes;
+    out.insert(out.end(), {uchar(is_final), uchar(n), uchar(n >> 8), uchar(~n), uchar(~n >> 8)});
+    out.insert(out.end(), data + done, data + done + n);
+    done += n;
+    if (is_final)
+      break;
+  }
+  if (last)
+    put_u32(out, z->adler);
+#endif
+  if (out.size() < idat_bytes && !last)
+    return ok;
+  bool written = write_chunk("IDAT", out.data(), out.size());
+  out.clear();
+  return written;
+}
+
+bool image_stream::write_row(const pixel_helper::color *row)
+{
+  if (!ok)
+    return false;
+  rows_written++;
+  // both formats store packed RGB
+  uchar *rgb = scanline.data() + 1;
+  for (int x = 0; x < width; x++)
+  {
+    rgb[3 * x] = row[x].r;
+    rgb[3 * x + 1] = row[x].g;
+    rgb[3 * x + 2] = row[x].b;
+  }
+  if (fmt == format::PPM)
+    return write(rgb, size_t(width) * 3);
+
+  // Sub filter in place, from the right
+  scanline[0] = filter_sub;
+  for (size_t i = size_t(width) * 3; i-- > 3;)
+    rgb[i] = static_cast<uchar>(rgb[i] - rgb[i - 3]);
+  return deflate(scanline.data(), scanline.size(), false);
+}
+
+bool image_stream::finish()
+{
+  if (ok && rows_written != height)
+  {
+    ok = false;
+    error = "image is incomplete";
+  }
+  if (ok && fmt == format::PNG)
+    deflate(nullptr, 0, true) && write_chunk("IEND", nullptr, 0);
+  file.close();
+  return ok;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <QFile>
+#include <QString>
+
+#include "superpixel.h"
+
+/* Image file written row by row from top to bottom, so the image is never held in memory whole:
+ * binary PPM (P6), or 8-bit RGB PNG deflated as the rows come
+ * (by zlib with MANDELBROT_ZLIB, otherwise in stored, i.e. uncompressed, deflate blocks) */
+class image_stream
+{
+public:
+  enum class format
+  {
+    PPM,
+    PNG
+  };
+
+  // .png suffix is PNG, anything else PPM
+  static format format_of(const QString &path);
+
+  image_stream(const QString &path, int width, int height);
+  image_stream(const image_stream &) = delete;
+  image_stream &operator=(const image_stream &) = delete;
+  ~image_stream();
+
+  // row of `width` pixels; returns false on error
+  bool write_row(const pixel_helper::color *row);
+  // pre: all `height` rows are written; returns false on error
+  bool finish();
+
+  bool is_ok() const
+  {
+    return ok;
+  }
+  QString error_string() const
+  {
+    return error;
+  }
+
+private:
+  struct deflater;
+
+  bool write(const void *data, size_t bytes);
+  bool write_chunk(const char *type, const uchar *data, size_t bytes);
+  // deflates PNG scanlines into IDAT chunks, the last call ends the stream
+  bool deflate(const uchar *data, size_t bytes, bool last);
+
+  QFile file;
+  const format fmt;
+  const int width, height;
+  int rows_written = 0;
+  bool ok = false;
+  QString error;
+  std::vector<uchar> scanline;  // PNG filter type, then packed RGB row (filtered for PNG)
+  std::unique_ptr<deflater> z;
+};
@@ -0,0 +1,91 @@
+#include <chrono>
+
+#include "escape_time.h"
+#include "perturbation.h"
+#include "kernel_tiers.h"
+
+kernel_tier kernel_tiers::select(qreal pixel_scale) const
+{
+  if (pixel_scale >= double_pixel_scale)
+    return kernel_tier::DOUBLE;
+  if (pixel_scale >= perturbation_pixel_scale)
+    return kernel_tier::DOUBLE_DOUBLE;
+  return kernel_tier::PERTURBATION;
+}
+
+kernel_tiers kernel_tiers::calibrate()
+{
+  // Misiurewicz point c = i: boundary has detail at every scale
+  static constexpr qreal center_x = 0, center_y = 1;
+  static constexpr int side = 32;
+  // reference orbit is computed once per view, amortize it over a full HD screen
+  static constexpr double screen_pixels = 1920 * 1080;
+  static constexpr qreal max_mismatch = 0.005;
+
+  using clock = std::chrono::steady_clock;
+  auto ns_since = [](clock::time_point begin) {
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - begin).count());
+  };
+
+  kernel_tiers res;
+  const escape_time::settings s;
+  float by_double[side], by_dd[side], by_perturbation[side];
+  qreal last_matching = 0;
+
+  for (qreal scale = 1e-10; scale > 1e-16; scale /= 10)
+  {
+    measurement m{scale, 0, 0, 0, 0};
+    size_t mismatches = 0;
+    double ns_double = 0, ns_dd = 0, ns_perturbation = 0;
+
+    auto begin = clock::now();
+    reference_orbit orbit(center_x, center_y, s);
+    ns_perturbation += ns_since(begin) * side * side / screen_pixels;
+
+    for (int y = 0; y < side; y++)
+    {
+      QPointF start = QPointF(-side / 2, y - side / 2) * scale, step(scale, 0);
+
+      begin = clock::now();
+      escape_time::calc_row(by_double, QPointF(center_x, center_y) + start, step, side, s);
+      ns_double += ns_since(begin);
+
+      begin = clock::now();
+      escape_time::calc_row(by_dd, center_x, center_y, start, step, side, s);
+      ns_dd += ns_since(begin);
+
+      begin = clock::now();
+      orbit.calc_row(by_perturbation, start, step, side);
+      ns_perturbation += ns_since(begin);
+
+      for (int x = 0; x < side; x++)
+        mismatches += by_double[x] != by_dd[x];
+    }
+
+    m.mismatch = mismatches * 1.0 / (side * side);
+    m.ns_per_pixel_double = ns_double / (side * side);
+    m.ns_per_pixel_dd = ns_dd / (side * side);
+    m.ns_per_pixel_perturbation = ns_perturbation / (side * side);
+    res.measurements.push_back(m);
+
+    if (m.mismatch > max_mismatch)
+      break;
+    last_matching = scale;
+  }
+
+  if (last_matching != 0)
+    res.double_pixel_scale = last_matching;
+  res.perturbation_pixel_scale = res.double_pixel_scale;
+
+  // compare deeper tiers where qreal stops being usable
+  const measurement &switch_over = res.measurements.back();
+  if (switch_over.ns_per_pixel_dd < switch_over.ns_per_pixel_perturbation)
+    res.perturbation_pixel_scale = 0;
+  return res;
+}
+
+const kernel_tiers &kernel_tiers::calibrated()
+{
+  static const kernel_tiers res = calibrate();
+  return res;
+}
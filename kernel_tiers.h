@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include <QTypeInfo>
+
+/* Precision tiers of the escape-time kernel, selected per view by pixel scale */
+enum class kernel_tier
+{
+  DOUBLE,         // plain qreal iteration (vectorized)
+  DOUBLE_DOUBLE,  // direct double-double iteration
+  PERTURBATION    // double precision deltas against a double-double reference orbit
+};
+
+struct kernel_tiers
+{
+  // qreal is used for pixel scales >= double_pixel_scale
+  qreal double_pixel_scale = 1e-13;
+  // perturbation is used below, double-double in between
+  qreal perturbation_pixel_scale = 1e-13;
+
+  struct measurement
+  {
+    qreal pixel_scale;
+    double mismatch;  // fraction of pixels where qreal and double-double results differ
+    double ns_per_pixel_double, ns_per_pixel_dd, ns_per_pixel_perturbation;
+  };
+  std::vector<measurement> measurements;
+
+  kernel_tier select(qreal pixel_scale) const;
+
+  /* Sets thresholds from measurements on a boundary-heavy scene:
+   * qreal is kept while its results still match double-double,
+   * then the faster of double-double and perturbation is taken at the switch-over depth */
+  static kernel_tiers calibrate();
+  // calibrate() on the first call, shared by all callers of the process
+  static const kernel_tiers &calibrated();
+};
@@ -0,0 +1,348 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <thread>
+#include <vector>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "blit.h"
+#include "offline_renderer.h"
+#include "perf_stats.h"
+#include "superpixel.h"
+#include "task_queue.h"
+#include "view_kernel.h"
+
+/* Microbenchmarks of the escape-time kernel, superpixel rendering, task queue and blitter on fixed scenes,
+ * printed as JSON to compare commits */
+
+namespace
+{
+  using clock = std::chrono::steady_clock;
+
+  constexpr int tile_size_pow = 8;
+  constexpr size_t tile_size = size_t(1) << tile_size_pow;
+  constexpr int max_iterations = 1000;
+
+  struct scene
+  {
+    const char *name;
+    double center_x, center_y;
+    qreal pixel_scale;
+    kernel_tier tier;
+  };
+
+  const scene scenes[] = {
+      {"shallow_exterior", 0.6, 0.9, 1e-3, kernel_tier::DOUBLE},
+      {"boundary_heavy", -0.743643887037158, 0.131825904205312, 1e-7, kernel_tier::DOUBLE},
+      // period 3 bulb
+      {"interior_heavy", -0.122561166876654, 0.744861766619744, 2e-4, kernel_tier::DOUBLE},
+      {"deep_1e-16_double_double", -0.743643887037158, 0.131825904205312, 1e-16, kernel_tier::DOUBLE_DOUBLE},
+      {"deep_1e-16_perturbation", -0.743643887037158, 0.131825904205312, 1e-16, kernel_tier::PERTURBATION},
+  };
+
+  const char *tier_name(kernel_tier tier)
+  {
+    switch (tier)
+    {
+    case kernel_tier::DOUBLE:
+      return "double";
+    case kernel_tier::DOUBLE_DOUBLE:
+      return "double_double";
+    case kernel_tier::PERTURBATION:
+      return "perturbation";
+    }
+    return "";
+  }
+
+  // the scene's tier is fixed, not calibrated, so results do not depend on the machine's thresholds
+  view_kernel make_kernel(const scene &sc)
+  {
+    view_kernel res;
+    res.tier = sc.tier;
+    res.settings.max_iterations = max_iterations;
+    res.origin_x = sc.center_x;
+    res.origin_y = sc.center_y;
+    if (sc.tier == kernel_tier::PERTURBATION)
+    {
+      res.orbit = view_kernel::defer_orbit(res.origin_x, res.origin_y, res.settings);
+      res.orbit.wait();  // computed before timing
+    }
+    return res;
+  }
+
+  // calls run() returning units of work until min_seconds pass, returns units per second
+  template<class Run>
+  double rate(double min_seconds, Run &&run)
+  {
+    auto begin = clock::now();
+    double units = 0, seconds;
+    do
+    {
+      units += run();
+      seconds = std::chrono::duration<double>(clock::now() - begin).count();
+    } while (seconds < min_seconds);
+    return units / seconds;
+  }
+
+  // dense tile centered at the scene center
+  QJsonObject bench_kernel(const scene &sc, double min_seconds)
+  {
+    const view_kernel kernel = make_kernel(sc);
+    std::vector<float> out(tile_size * tile_size);
+    auto run = [&] {
+      for (size_t y = 0; y < tile_size; y++)
+        kernel(out.data() + y * tile_size, QPointF(-qreal(tile_size) / 2, qreal(y) - tile_size / 2) * sc.pixel_scale,
+               QPointF(sc.pixel_scale, 0), tile_size);
+      return double(tile_size * tile_size);
+    };
+    // one tile on this thread alone: the counters it adds are the shortcuts of the scene
+    auto count = [](perf_stats::counter c) { return perf_stats::counters[size_t(c)].load(); };
+    const uint64_t cardioid_bulb = count(perf_stats::counter::CARDIOID_BULB_PIXELS);
+    const uint64_t periodic = count(perf_stats::counter::PERIODIC_PIXELS);
+    run();
+    const double pixels = double(out.size());
+    const double cardioid_bulb_share = (count(perf_stats::counter::CARDIOID_BULB_PIXELS) - cardioid_bulb) / pixels;
+    const double periodic_share = (count(perf_stats::counter::PERIODIC_PIXELS) - periodic) / pixels;
+    // iteration values summed, interior pixels count as max_iterations
+    double iterations_per_pixel = std::accumulate(out.begin(), out.end(), 0.) / pixels;
+    double pixels_per_s = rate(min_seconds, run);
+
+    QJsonObject res;
+    res["scene"] = sc.name;
+    res["tier"] = tier_name(sc.tier);
+    res["pixels_per_s"] = pixels_per_s;
+    res["iterations_per_s"] = pixels_per_s * iterations_per_pixel;
+    // shares of the pixels resolved by the interior shortcuts
+    res["cardioid_bulb_share"] = cardioid_bulb_share;
+    res["periodic_share"] = periodic_share;
+    return res;
+  }
+
+  // thresholds calibrated on this machine and the measurements they are picked from
+  QJsonObject bench_tiers(const kernel_tiers &tiers)
+  {
+    QJsonArray measurements;
+    for (const kernel_tiers::measurement &m : tiers.measurements)
+    {
+      QJsonObject row;
+      row["pixel_scale"] = m.pixel_scale;
+      row["mismatch"] = m.mismatch;
+      row["ns_per_pixel_double"] = m.ns_per_pixel_double;
+      row["ns_per_pixel_double_double"] = m.ns_per_pixel_dd;
+      row["ns_per_pixel_perturbation"] = m.ns_per_pixel_perturbation;
+      measurements.append(row);
+    }
+
+    QJsonObject res;
+    res["double_pixel_scale"] = tiers.double_pixel_scale;
+    res["perturbation_pixel_scale"] = tiers.perturbation_pixel_scale;
+    res["measurements"] = measurements;
+    return res;
+  }
+
+  // superpixel rendered as in the viewer: every mip level from the coarsest, subdividing on the nested grid
+  QJsonObject bench_tile(const scene &sc, double min_seconds)
+  {
+    using tile = superpixel<view_kernel, tile_size, float>;
+    const qreal scale = tile_size * sc.pixel_scale;
+    tile t(make_kernel(sc), QPointF(-scale / 2, -scale / 2), scale);
+    t.grid = tile::sample_grid::NESTED;
+    t.mode = tile::render_mode::SUBDIVIDE;
+    double tiles_per_s = rate(min_seconds, [&] {
+      t.set_mip_level(tile_size_pow);
+      while (t.last_mip_level != 0)
+      {
+        auto job = t.next_job();
+        t.publish(job, job.render([] { return false; }));
+      }
+      return 1.;
+    });
+
+    QJsonObject res;
+    res["scene"] = sc.name;
+    res["tiles_per_s"] = tiles_per_s;
+    return res;
+  }
+
+  // image of the scene on all workers
+  QJsonObject bench_image(offline_renderer &renderer, const scene &sc, double min_seconds)
+  {
+    offline_renderer::view v;
+    v.center_x = sc.center_x;
+    v.center_y = sc.center_y;
+    v.pixel_scale = sc.pixel_scale;
+    v.tier = sc.tier;
+    v.width = v.height = 4 * tile_size;
+    v.settings.max_iterations = max_iterations;
+    double tiles_per_s = rate(min_seconds, [&] {
+      renderer.render(v, [](const float *, int) { return true; });
+      return 16.;
+    });
+
+    QJsonObject res;
+    res["scene"] = sc.name;
+    res["tier"] = tier_name(sc.tier);
+    res["threads"] = int(renderer.get_n_workers());
+    res["tiles_per_s"] = tiles_per_s;
+    return res;
+  }
+
+  struct queue_task
+  {
+    size_t priority()
+    {
+      return 0;
+    }
+  };
+
+  // every thread pops a task and pushes it back, to its own deque or round-robin (so they are stolen)
+  QJsonObject bench_queue(unsigned n_threads, bool is_round_robin, double min_seconds)
+  {
+    using queue_t = work_stealing_queue<queue_task, 0>;
+    queue_t queue(n_threads);
+    std::vector<queue_t::store_type> tasks(4 * n_threads);
+    for (auto &t : tasks)
+      queue.push(t);
+
+    std::atomic<bool> is_stopped = false;
+    std::atomic<uint64_t> ops = 0;
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < n_threads; i++)
+      threads.emplace_back([&, i] {
+        uint64_t n = 0;
+        while (!is_stopped.load(std::memory_order_relaxed))
+        {
+          queue_t::store_type &t = queue.pop(i);
+          queue.push(t, is_round_robin ? queue_t::any_worker : i);
+          n++;
+        }
+        ops.fetch_add(n);
+      });
+    auto begin = clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(min_seconds));
+    is_stopped = true;
+    for (auto &th : threads)
+      th.join();
+    double seconds = std::chrono::duration<double>(clock::now() - begin).count();
+
+    QJsonObject res;
+    res["threads"] = int(n_threads);
+    res["push"] = is_round_robin ? "round_robin" : "own";
+    res["push_pop_per_s"] = ops.load() / seconds;
+    return res;
+  }
+
+  // superpixels of a mip level drawn over a 4K screen as one batch
+  QJsonObject bench_blit(int mip_level, blit_workers &workers, double min_seconds)
+  {
+    constexpr int scr_w = 3840, scr_h = 2160;
+    const int mip_size = static_cast<int>(tile_size >> mip_level);
+    std::vector<pixel_helper::color> screen(scr_w * scr_h);
+    std::vector<pixel_helper::color> data(mip_size * mip_size, pixel_helper::color(uchar(1), uchar(2), uchar(3)));
+    std::vector<mip_blit> blits;
+    for (int y = 0; y < scr_h; y += tile_size)
+      for (int x = 0; x < scr_w; x += tile_size)
+        blits.push_back({data.data(), x, y, mip_size, mip_size, mip_level});
+    double bytes_per_s = rate(min_seconds, [&] {
+      draw_mips(screen, scr_w, scr_h, blits, &workers);
+      return double(screen.size() * sizeof(pixel_helper::color));
+    });
+
+    QJsonObject res;
+    res["mip_level"] = mip_level;
+    res["threads"] = int(workers.get_n_threads());
+    res["mb_per_s"] = bytes_per_s / (1 << 20);
+    return res;
+  }
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("mandelbrot_bench");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Benchmarks the kernel, superpixel renderer, task queue and blitter "
+                                   "on fixed scenes, prints JSON.");
+  parser.addHelpOption();
+  QCommandLineOption time_option({"t", "time"}, "Minimal seconds per measurement.", "seconds", "0.5");
+  QCommandLineOption threads_option({"j", "threads"}, "Max threads (default: hardware concurrency).", "count");
+  QCommandLineOption output_option({"o", "output"}, "JSON file (default: standard output).", "file");
+  QCommandLineOption label_option("label", "Label stored with the results, e.g. commit hash.", "text");
+  parser.addOptions({time_option, threads_option, output_option, label_option});
+  parser.process(app);
+
+  bool ok = false;
+  const double min_seconds = parser.value(time_option).toDouble(&ok);
+  unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+  if (ok && parser.isSet(threads_option))
+    max_threads = parser.value(threads_option).toUInt(&ok);
+  if (!ok || min_seconds <= 0 || max_threads == 0)
+  {
+    std::cerr << "Invalid arguments, see --help" << std::endl;
+    return 1;
+  }
+
+  QJsonObject res;
+  res["label"] = parser.value(label_option);
+  res["max_iterations"] = max_iterations;
+  res["hardware_threads"] = int(std::thread::hardware_concurrency());
+
+  std::cerr << "Kernel tiers" << std::endl;
+  res["kernel_tiers"] = bench_tiers(kernel_tiers::calibrated());
+
+  QJsonArray kernel, tile, image;
+  offline_renderer renderer(max_threads);
+  for (const scene &sc : scenes)
+  {
+    std::cerr << "Scene " << sc.name << std::endl;
+    kernel.append(bench_kernel(sc, min_seconds));
+    tile.append(bench_tile(sc, min_seconds));
+    image.append(bench_image(renderer, sc, min_seconds));
+  }
+  res["kernel"] = kernel;
+  res["tile"] = tile;
+  res["image"] = image;
+
+  std::cerr << "Task queue" << std::endl;
+  QJsonArray queue;
+  for (unsigned n = 1;; n = std::min(2 * n, max_threads))
+  {
+    queue.append(bench_queue(n, false, min_seconds));
+    queue.append(bench_queue(n, true, min_seconds));
+    if (n == max_threads)
+      break;
+  }
+  res["queue"] = queue;
+
+  std::cerr << "Blit" << std::endl;
+  QJsonArray blit;
+  blit_workers one_thread(1), all_threads(max_threads);
+  for (int mip_level = 0; mip_level <= tile_size_pow; mip_level++)
+  {
+    blit.append(bench_blit(mip_level, one_thread, min_seconds));
+    if (max_threads > 1)
+      blit.append(bench_blit(mip_level, all_threads, min_seconds));
+  }
+  res["blit"] = blit;
+
+  const QByteArray json = QJsonDocument(res).toJson();
+  if (!parser.isSet(output_option))
+  {
+    std::cout << json.constData();
+    return 0;
+  }
+  QFile file(parser.value(output_option));
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size())
+  {
+    std::cerr << "Cannot write " << parser.value(output_option).toStdString() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QProcess>
+
+#include "image_stream.h"
+#include "offline_renderer.h"
+#include "palette.h"
+#include "render_farm.h"
+#include "tile_tuning.h"
+
+// decimal exponents past it are out of the double range with any mantissa
+constexpr int max_decimal_exponent = 400;
+// largest power of ten applied at once, 10^max_scale_exponent is well inside the double range
+constexpr int max_scale_exponent = 300;
+
+// 10^n by squaring, so that it takes a handful of dd roundings instead of n
+static dd_real dd_pow10(int n)
+{
+  dd_real res = 1, base = 10;
+  for (; n > 0; n >>= 1)
+  {
+    if (n & 1)
+      res = res * base;
+    base = base * base;
+  }
+  return res;
+}
+
+// decimal number with up to 32 significant digits and an optional exponent, e.g. -0.74364388703715870475219e-1
+static bool parse_dd_real(const QString &text, dd_real &res)
+{
+  const std::string s = text.trimmed().toStdString();
+  size_t i = 0;
+  bool is_negative = false, is_fraction = false, has_digits = false;
+  if (i < s.size() && (s[i] == '+' || s[i] == '-'))
+    is_negative = s[i++] == '-';
+
+  dd_real mantissa = 0;
+  int exponent = 0;
+  for (; i < s.size(); i++)
+  {
+    if (s[i] == '.' && !is_fraction)
+    {
+      is_fraction = true;
+      continue;
+    }
+    if (s[i] < '0' || s[i] > '9')
+      break;
+    has_digits = true;
+    if (mantissa.hi < 1e31)
+    {
+      mantissa = mantissa * dd_real(10) + dd_real(s[i] - '0');
+      exponent -= is_fraction;
+    }
+    else
+      exponent += !is_fraction;  // digits beyond the precision
+  }
+  if (!has_digits)
+    return false;
+  if (i < s.size() && (s[i] == 'e' || s[i] == 'E'))
+  {
+    bool ok = false;
+    const int e = QString::fromStdString(s.substr(i + 1)).toInt(&ok);
+    if (!ok || std::abs(e) > max_decimal_exponent)
+      return false;
+    exponent += e;
+  }
+  else if (i != s.size())
+    return false;
+  if (std::abs(exponent) > max_decimal_exponent)
+    return false;
+
+  // one multiplication or division by an exact-to-dd power of ten, two when the power is past the double range
+  res = mantissa;
+  for (int left = std::abs(exponent); left > 0; left -= max_scale_exponent)
+  {
+    const dd_real scale = dd_pow10(std::min(left, max_scale_exponent));
+    res = exponent >= 0 ? res * scale : res / scale;
+  }
+  if (is_negative)
+    res = -res;
+  // an underflow to 0 would silently move the view to the origin
+  if (res.hi == 0 && mantissa.hi != 0)
+    return false;
+  return std::isfinite(res.hi) && std::isfinite(res.lo);
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("mandelbrot_render");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Renders the Mandelbrot set to a PPM or PNG image without a window, "
+                                   "streaming rows to the file with memory bounded by the image width.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("output", "Image file: .png for PNG, PPM otherwise.");
+  QCommandLineOption center_x_option({"x", "center-x"}, "Real part of the image center.", "real", "-0.5");
+  QCommandLineOption center_y_option({"y", "center-y"}, "Imaginary part of the image center.", "real", "0");
+  QCommandLineOption scale_option({"s", "scale"}, "Distance between pixels (default: 3 / width).", "real");
+  QCommandLineOption width_option({"W", "width"}, "Image width in pixels.", "pixels", "1920");
+  QCommandLineOption height_option({"H", "height"}, "Image height in pixels.", "pixels", "1080");
+  QCommandLineOption iterations_option({"i", "iterations"}, "Max iterations.", "count",
+                                       QString::number(escape_time::default_max_iterations));
+  QCommandLineOption smooth_option("smooth", "Smooth coloring.");
+  QCommandLineOption period_option("period", "Palette period in iterations.", "iterations",
+                                   QString::number(palette::default_period));
+  QCommandLineOption threads_option({"j", "threads"}, "Worker threads (default: hardware concurrency).", "count");
+  QCommandLineOption tile_size_option("tile-size",
+                                      "Superpixel size: 64, 128, 256 or 512 pixels, or auto to measure the fastest "
+                                      "on a sample of the image.",
+                                      "pixels", QString::number(1 << tile_size::default_pow));
+  QCommandLineOption listen_option("listen",
+                                   "Renders on farm workers connecting to address: host:port for TCP, the name of "
+                                   "a local socket otherwise.",
+                                   "address");
+  QCommandLineOption spawn_option("spawn",
+                                  "Starts count farm workers on this host splitting the threads, connecting to a "
+                                  "local socket unless --listen is given.",
+                                  "count");
+  QCommandLineOption worker_timeout_option(
+      "worker-timeout",
+      "Drops a farm worker sending nothing for that long while it has superpixels, sending them to the others.",
+      "seconds", QString::number(render_farm::coordinator::default_result_timeout.count()));
+  QCommandLineOption worker_option("farm-worker",
+                                   "Renders tiles for the coordinator at address (see --listen) until it quits, "
+                                   "instead of an image.",
+                                   "address");
+  // for tests: the farm worker disconnects after sending that many results
+  QCommandLineOption worker_results_option("farm-worker-results", "Disconnects after count results.", "count");
+  worker_results_option.setFlags(QCommandLineOption::HiddenFromHelp);
+  parser.addOptions({center_x_option, center_y_option, scale_option, width_option, height_option, iterations_option,
+                     smooth_option, period_option, threads_option, tile_size_option, listen_option, spawn_option,
+                     worker_timeout_option, worker_option, worker_results_option});
+  parser.process(app);
+
+  const bool is_worker = parser.isSet(worker_option);
+  const QStringList args = parser.positionalArguments();
+  if (args.size() != (is_worker ? 0 : 1))
+    parser.showHelp(1);
+
+  offline_renderer::view v;
+  bool is_valid = parse_dd_real(parser.value(center_x_option), v.center_x) &&
+                  parse_dd_real(parser.value(center_y_option), v.center_y);
+  bool ok = false;
+  v.width = parser.value(width_option).toInt(&ok);
+  is_valid = is_valid && ok && v.width > 0;
+  v.height = parser.value(height_option).toInt(&ok);
+  is_valid = is_valid && ok && v.height > 0;
+  v.pixel_scale = parser.isSet(scale_option) ? parser.value(scale_option).toDouble(&ok) : 3. / v.width;
+  is_valid = is_valid && ok && v.pixel_scale > 0;
+  v.settings.max_iterations = parser.value(iterations_option).toInt(&ok);
+  is_valid = is_valid && ok && v.settings.max_iterations > 0;
+  v.settings.smooth = parser.isSet(smooth_option);
+  const qreal period = parser.value(period_option).toDouble(&ok);
+  is_valid = is_valid && ok && period > 0;
+  unsigned n_threads = std::max(1u, std::thread::hardware_concurrency());
+  if (parser.isSet(threads_option))
+  {
+    n_threads = parser.value(threads_option).toUInt(&ok);
+    is_valid = is_valid && ok && n_threads > 0;
+  }
+  unsigned n_spawn = 0;
+  if (parser.isSet(spawn_option))
+  {
+    n_spawn = parser.value(spawn_option).toUInt(&ok);
+    is_valid = is_valid && ok && n_spawn > 0;
+  }
+  size_t max_worker_results = 0;
+  if (parser.isSet(worker_results_option))
+  {
+    max_worker_results = parser.value(worker_results_option).toUInt(&ok);
+    is_valid = is_valid && ok && max_worker_results > 0;
+  }
+  const bool is_farm = parser.isSet(listen_option) || n_spawn > 0;
+  const double worker_timeout_s = parser.value(worker_timeout_option).toDouble(&ok);
+  is_valid = is_valid && ok && worker_timeout_s > 0 && worker_timeout_s <= 24 * 3600;
+  // measured on this host, the farm takes the default
+  const bool is_tile_size_auto = parser.value(tile_size_option) == "auto";
+  const int tile_size_pow =
+      is_tile_size_auto ? tile_size::default_pow : tile_size::parse(parser.value(tile_size_option));
+  is_valid = is_valid && tile_size::is_valid(tile_size_pow);
+  if (!is_valid)
+  {
+    std::cerr << "Invalid arguments, see --help" << std::endl;
+    return 1;
+  }
+
+  if (is_worker)
+  {
+    offline_renderer renderer(n_threads, tile_size_pow);
+    QString error;
+    if (!render_farm::run_worker(parser.value(worker_option), renderer, error, max_worker_results))
+    {
+      std::cerr << "Farm worker: " << error.toStdString() << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  image_stream out(args.front(), v.width, v.height);
+  if (!out.is_ok())
+  {
+    std::cerr << "Cannot write " << args.front().toStdString() << ": " << out.error_string().toStdString()
+              << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<offline_renderer> renderer;
+  std::unique_ptr<render_farm::coordinator> farm;
+  std::vector<std::unique_ptr<QProcess>> workers;  // killed if still running when destroyed
+  if (is_farm)
+  {
+    const QString address = parser.isSet(listen_option)
+                                ? parser.value(listen_option)
+                                : QString("mandelbrot_farm_%1").arg(QCoreApplication::applicationPid());
+    farm = std::make_unique<render_farm::coordinator>(
+        address, std::chrono::milliseconds(static_cast<int64_t>(std::ceil(worker_timeout_s * 1000))));
+    if (!farm->is_listening())
+    {
+      std::cerr << "Cannot listen on " << address.toStdString() << ": " << farm->error_string().toStdString()
+                << std::endl;
+      return 1;
+    }
+    for (unsigned i = 0; i < n_spawn; i++)
+    {
+      const unsigned worker_threads = std::max(1u, n_threads / n_spawn + (i < n_threads % n_spawn));
+      workers.push_back(std::make_unique<QProcess>());
+      workers.back()->setProcessChannelMode(QProcess::ForwardedChannels);
+      workers.back()->start(QCoreApplication::applicationFilePath(),
+                            {"--farm-worker", address, "-j", QString::number(worker_threads)});
+    }
+  }
+  else
+  {
+    renderer = std::make_unique<offline_renderer>(n_threads, tile_size_pow);
+    if (is_tile_size_auto)
+    {
+      std::vector<tile_tuning::result> results = tile_tuning::measure_image(*renderer, v);
+      for (const tile_tuning::result &r : results)
+        std::cout << "superpixel " << (1 << r.size_pow) << ": " << r.pixels_per_s / 1e6 << " Mpixels/s" << std::endl;
+      renderer->set_tile_size_pow(tile_tuning::pick(results));
+    }
+  }
+
+  const palette pal(period, v.settings.max_iterations);
+  std::vector<pixel_helper::color> colors(v.width);
+  auto write_row = [&](const float *values, int) {
+    pal.colorize(colors.data(), values, colors.size());
+    return out.write_row(colors.data());
+  };
+  auto begin = std::chrono::steady_clock::now();
+  bool is_done = farm != nullptr ? farm->render(v, tile_size_pow, write_row) : renderer->render(v, write_row);
+  is_done = out.finish() && is_done;
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  if (!is_done)
+  {
+    if (farm != nullptr && !farm->error_string().isEmpty())
+      std::cerr << "Render farm: " << farm->error_string().toStdString() << std::endl;
+    else
+      std::cerr << "Cannot write " << args.front().toStdString() << ": " << out.error_string().toStdString()
+                << std::endl;
+    return 1;
+  }
+
+  double pixels = double(v.width) * v.height;
+  unsigned total_threads = renderer != nullptr ? renderer->get_n_workers() : 0;
+  if (farm != nullptr)
+  {
+    // throughput of every worker
+    for (const render_farm::worker_report &r : farm->get_reports())
+    {
+      total_threads += r.is_connected ? r.n_threads : 0;
+      std::cout << r.name.toStdString() << ": " << r.n_threads << " threads, " << r.tiles << " superpixels, "
+                << (r.seconds > 0 ? r.pixels / r.seconds / 1e6 : 0) << " Mpixels/s, "
+                << (r.payload_bytes > 0 ? double(r.raw_bytes) / r.payload_bytes : 0) << "x compressed ("
+                << r.payload_bytes / 1e6 << " MB)";
+      if (!r.is_connected)
+        std::cout << (r.is_timed_out ? ", timed out" : ", disconnected") << " with " << r.lost_tiles << " superpixels";
+      std::cout << std::endl;
+    }
+    farm.reset();  // the workers quit
+    for (auto &w : workers)
+      w->waitForFinished();
+  }
+  std::cout << v.width << "x" << v.height << " pixels in " << seconds << " s on " << total_threads
+            << " threads, superpixel " << (1 << (renderer != nullptr ? renderer->get_tile_size_pow() : tile_size_pow))
+            << ": " << pixels / seconds / 1e6 << " Mpixels/s" << std::endl;
+  return 0;
+}
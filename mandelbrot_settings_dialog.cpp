@@ -1,5 +1,6 @@
 #include "mandelbrot_settings_dialog.h"
 #include "mapper_enterprise.h"
+#include "palette.h"
 
 mandelbrot_settings_dialog::mandelbrot_settings_dialog(QWidget *parent)
     : QDialog(parent), settings("NH5 Software", "Mandelbrot Viewer")
@@ -7,8 +8,15 @@ mandelbrot_settings_dialog::mandelbrot_settings_dialog(QWidget *parent)
   ui.setupUi(this);
   int level = settings.value("Draft level", 4).toInt();
   ui.spinBox->setMinimum(0);
-  ui.spinBox->setMaximum(mapper_enterprise::max_draft_mip_level);
+  // levels coarser than the superpixel size in use allows are clamped by it
+  ui.spinBox->setMaximum(tile_size::max_pow);
   ui.spinBox->setValue(level);
+  ui.maxIterationsSpinBox->setValue(settings.value("Max iterations", escape_time::default_max_iterations).toInt());
+  ui.palettePeriodSpinBox->setValue(settings.value("Palette period", palette::default_period).toInt());
+  ui.draftDeadlineSpinBox->setMaximum(mapper_enterprise::max_draft_deadline_ms);
+  ui.draftDeadlineSpinBox->setValue(
+      settings.value("Draft deadline", mapper_enterprise::default_draft_deadline_ms).toInt());
+  ui.smoothCheckBox->setChecked(settings.value("Smooth", false).toBool());
 }
 
 int mandelbrot_settings_dialog::get_draft_level() const
@@ -16,12 +24,56 @@ int mandelbrot_settings_dialog::get_draft_level() const
   return ui.spinBox->value();
 }
 
+int mandelbrot_settings_dialog::get_max_iterations() const
+{
+  return ui.maxIterationsSpinBox->value();
+}
+
+int mandelbrot_settings_dialog::get_palette_period() const
+{
+  return ui.palettePeriodSpinBox->value();
+}
+
+int mandelbrot_settings_dialog::get_draft_deadline() const
+{
+  return ui.draftDeadlineSpinBox->value();
+}
+
+bool mandelbrot_settings_dialog::get_smooth() const
+{
+  return ui.smoothCheckBox->isChecked();
+}
+
 void mandelbrot_settings_dialog::on_draftLevelChanged(int level)
 {
   settings.setValue("Draft level", level);
   emit draft_level_changed(level);
 }
 
+void mandelbrot_settings_dialog::on_maxIterationsChanged(int max_iterations)
+{
+  settings.setValue("Max iterations", max_iterations);
+  emit max_iterations_changed(max_iterations);
+}
+
+void mandelbrot_settings_dialog::on_palettePeriodChanged(int period)
+{
+  settings.setValue("Palette period", period);
+  emit palette_period_changed(period);
+}
+
+void mandelbrot_settings_dialog::on_draftDeadlineChanged(int deadline_ms)
+{
+  settings.setValue("Draft deadline", deadline_ms);
+  emit draft_deadline_changed(deadline_ms);
+}
+
+void mandelbrot_settings_dialog::on_smoothChanged(bool smooth)
+{
+  settings.setValue("Smooth", smooth);
+  emit smooth_changed(smooth);
+}
+
 mandelbrot_settings_dialog::~mandelbrot_settings_dialog()
 {
 }
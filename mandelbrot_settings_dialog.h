@@ -14,11 +14,23 @@ public:
 
 public:
   int get_draft_level() const;
+  int get_max_iterations() const;
+  int get_palette_period() const;
+  int get_draft_deadline() const;
+  bool get_smooth() const;
 
 public slots:
   void on_draftLevelChanged(int level);
+  void on_maxIterationsChanged(int max_iterations);
+  void on_palettePeriodChanged(int period);
+  void on_draftDeadlineChanged(int deadline_ms);
+  void on_smoothChanged(bool smooth);
 signals:
   void draft_level_changed(int level);
+  void max_iterations_changed(int max_iterations);
+  void palette_period_changed(int period);
+  void draft_deadline_changed(int deadline_ms);
+  void smooth_changed(bool smooth);
 private:
   Ui::mandelbrot_settings_dialog ui;
   QSettings settings;
@@ -1,16 +1,31 @@
 #include <QLayout>
 #include <QDialog>
+#include <QFileDialog>
+#include <QMessageBox>
 
 #include "mandelbrot_viewer.h"
 #include "mapper_widget.h"
+#include "trace.h"
 
 mandelbrot_viewer::mandelbrot_viewer(QWidget *parent) : QMainWindow(parent), dlg(this), widget(this)
 {
   ui.setupUi(this);
   setCentralWidget(&widget);
   connect(&dlg, &mandelbrot_settings_dialog::draft_level_changed, this, &mandelbrot_viewer::on_draftLevelChanged);
+  connect(&dlg, &mandelbrot_settings_dialog::max_iterations_changed, this, &mandelbrot_viewer::on_maxIterationsChanged);
+  connect(&dlg, &mandelbrot_settings_dialog::palette_period_changed, this, &mandelbrot_viewer::on_palettePeriodChanged);
+  connect(&dlg, &mandelbrot_settings_dialog::draft_deadline_changed, this, &mandelbrot_viewer::on_draftDeadlineChanged);
+  connect(&dlg, &mandelbrot_settings_dialog::smooth_changed, this, &mandelbrot_viewer::on_smoothChanged);
   QMetaObject::invokeMethod(this, "on_draftLevelChanged", Qt::QueuedConnection,
                             Q_ARG(int, dlg.get_draft_level()));
+  QMetaObject::invokeMethod(this, "on_maxIterationsChanged", Qt::QueuedConnection,
+                            Q_ARG(int, dlg.get_max_iterations()));
+  QMetaObject::invokeMethod(this, "on_palettePeriodChanged", Qt::QueuedConnection,
+                            Q_ARG(int, dlg.get_palette_period()));
+  QMetaObject::invokeMethod(this, "on_draftDeadlineChanged", Qt::QueuedConnection,
+                            Q_ARG(int, dlg.get_draft_deadline()));
+  QMetaObject::invokeMethod(this, "on_smoothChanged", Qt::QueuedConnection,
+                            Q_ARG(bool, dlg.get_smooth()));
 }
 
 void mandelbrot_viewer::on_settings()
@@ -18,8 +33,46 @@ void mandelbrot_viewer::on_settings()
   dlg.show();
 }
 
+void mandelbrot_viewer::on_traceToggled(bool is_recording)
+{
+  if (is_recording)
+  {
+    trace::start();
+    return;
+  }
+  trace::stop();
+  QString path = QFileDialog::getSaveFileName(this, "Save Trace", "mandelbrot_trace.json",
+                                              "Chrome trace (*.json)");
+  if (!path.isEmpty() && !trace::dump(path))
+    QMessageBox::warning(this, "Save Trace", "Cannot write " + path);
+}
+
 void mandelbrot_viewer::on_draftLevelChanged(int new_draft_level)
 {
   QMetaObject::invokeMethod(&widget, "change_draft_mip_level_event", Qt::QueuedConnection,
                             Q_ARG(int, new_draft_level));
 }
+
+void mandelbrot_viewer::on_maxIterationsChanged(int new_max_iterations)
+{
+  QMetaObject::invokeMethod(&widget, "change_max_iterations_event", Qt::QueuedConnection,
+                            Q_ARG(int, new_max_iterations));
+}
+
+void mandelbrot_viewer::on_palettePeriodChanged(int new_period)
+{
+  QMetaObject::invokeMethod(&widget, "change_palette_period_event", Qt::QueuedConnection,
+                            Q_ARG(int, new_period));
+}
+
+void mandelbrot_viewer::on_draftDeadlineChanged(int new_draft_deadline_ms)
+{
+  QMetaObject::invokeMethod(&widget, "change_draft_deadline_event", Qt::QueuedConnection,
+                            Q_ARG(int, new_draft_deadline_ms));
+}
+
+void mandelbrot_viewer::on_smoothChanged(bool new_smooth)
+{
+  QMetaObject::invokeMethod(&widget, "change_smooth_event", Qt::QueuedConnection,
+                            Q_ARG(bool, new_smooth));
+}
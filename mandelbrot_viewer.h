@@ -15,7 +15,13 @@ public:
 
 public slots:
   void on_settings();
+  // recording starts when checked, and is saved to a chosen file when unchecked
+  void on_traceToggled(bool is_recording);
   void on_draftLevelChanged(int new_draft_level);
+  void on_maxIterationsChanged(int new_max_iterations);
+  void on_palettePeriodChanged(int new_period);
+  void on_draftDeadlineChanged(int new_draft_deadline_ms);
+  void on_smoothChanged(bool new_smooth);
 
 private:
 
@@ -0,0 +1,236 @@
+#pragma once
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+
+#include <QDir>
+#include <QImage>
+#include <QRect>
+#include <QStandardPaths>
+#include <QTimer>
+
+#include "intrusive_list.h"
+#include "camera.h"
+#include "escape_time.h"
+#include "kernel_tiers.h"
+#include "mapper_enterprise.h"
+#include "perf_stats.h"
+#include "superpixel.h"
+#include "task_queue.h"
+#include "tile_cache.h"
+#include "tile_grid.h"
+#include "tile_pyramid.h"
+#include "trace.h"
+#include "view_kernel.h"
+
+/* mapper_enterprise with superpixels of 1 << SizePow pixels, instantiated for every tile_size */
+template<int SizePow>
+class mapper_engine final : public mapper_enterprise
+{
+public:
+  mapper_engine();
+  ~mapper_engine() override;
+
+  qreal zoom(QPointF mposf, int delta) override;
+  void pan(QPointF mdposf) override;
+  void resize(QSize size) override;
+  void change_draft_mip_level(int new_draft_mip_level) override;
+  void change_draft_deadline(int new_draft_deadline_ms) override;
+  void change_kernel_settings(escape_time::settings new_settings) override;
+  escape_time::settings get_kernel_settings() const override;
+  void focus(QPointF mposf) override;
+  memory_usage get_memory_usage() const override;
+  void sample_stats() const override;
+  void visit_output(const std::function<void(const output_tile &)> &func) override;
+
+private:
+  static constexpr size_t superpixel_size_pow = SizePow;
+  static constexpr size_t superpixel_size = 1 << superpixel_size_pow;
+
+  /* Tasks of a mip level are ordered by viewport class: off-screen (cached) superpixels are 0,
+   * visible ones farther than focus_rings superpixels from the focus are 1, the nearer ones are higher */
+  static constexpr int focus_rings = 4;
+  static constexpr size_t viewport_classes = focus_rings + 2;
+
+  // type for task queue
+  struct superpixel_base : intrusive::list_element<struct task_pool_tag>,
+                           ::superpixel<view_kernel, superpixel_size, float>
+  {
+    using base_t = ::superpixel<view_kernel, superpixel_size, float>;
+    using base_t::base_t;
+
+    // coarser levels first, then by viewport class
+    size_t priority()
+    {
+      return (this->last_mip_level - 1) * viewport_classes + viewport_class;
+    }
+
+    enum INPUT_VERSION : size_t
+    {
+      QUIT, FREE, NORMAL
+    };
+    std::atomic<size_t> input_version;
+    bool is_draft;
+    int grid_x, grid_y;         // tile on the screen grid
+    size_t viewport_class = 0;  // of the last push
+    size_t first_pixel_wave;    // of the input change that added it
+    bool is_cache_pending;      // not looked up in the disk cache and the pyramid yet
+    tile_cache::key cache_key;
+  };
+
+  // what a worker renders, taken from the superpixel under the global lock
+  struct render_task
+  {
+    typename superpixel_base::render_job job;
+    size_t input_version;
+    tile_cache::key cache_key;
+    bool is_cache_lookup = false;  // tried in the disk cache, then assembled from the pyramid, before rendering
+    int assembled_mip_level = 0;
+    std::function<void(float *)> assemble;  // copies the pyramid tiles found, if any
+  };
+
+  static constexpr int max_draft_mip_level = superpixel_size_pow;
+
+  int draft_mip_level = max_draft_mip_level;
+  std::chrono::milliseconds draft_deadline{default_draft_deadline_ms};  // of the first input change of a redraw
+  using task_queue_t = work_stealing_queue<superpixel_base, (max_draft_mip_level + 1) * viewport_classes - 1>;
+  using superpixel = typename task_queue_t::store_type;
+
+  // superpixel published with input version, waiting for flush_output
+  struct completion
+  {
+    superpixel *p;
+    size_t input_version;
+  };
+
+  void flush_output() override;
+  void release_drafts() override;
+  // pre: global mutex is locked
+  // what the GUI draws of p; the first new superpixel drawn since input changes records first pixel latency
+  output_tile output(const superpixel &p);
+
+  /* Modify superpixels functions */
+  // pre: global mutex is locked
+  superpixel &allocate_superpixel(QPointF ul_corner, qreal scale);
+  // pre: global mutex is locked
+  void free_superpixel(superpixel &pixel);
+  // pre: global mutex is locked
+  void push_task(superpixel &p, size_t worker = task_queue_t::any_worker);
+
+  /* Viewport priority functions */
+  // Classes rising on a viewport change are requeued eagerly, walking only the visible superpixels;
+  // falling ones are requeued lazily by the worker popping them, so the queue itself is never walked
+  // pre: global mutex is locked
+  size_t current_viewport_class(const superpixel &p) const;
+  // pre: global mutex is locked
+  // visible tiles and the focus tile for the current camera and grid
+  void update_viewport();
+  // pre: global mutex is locked
+  // requeues visible tasks queued with a lower class than their current one
+  void raise_visible_tasks();
+
+  /* Update screen's superpixels functions */
+  // pre: global mutex is locked
+  // tiles of the screen grid intersecting the screen extended by ratio
+  template<class ratio>
+  typename tile_grid<superpixel>::range screen_tiles() const;
+  // pre: global mutex is locked
+  QPointF tile_corner(int x, int y) const;
+  // pre: global mutex is locked
+  // moves the grid to cover the screen, keeping superpixels of the caching screen (1.5x) it has already
+  void update_screen_grid();
+
+  // pre: global mutex is locked (unlocks)
+  void update_screen(bool wait_drafts = true);
+  // pre: global mutex is locked (unlocks)
+  void rerender_screen(bool wait_drafts = true);
+  // rebuilds the screen at the zoomed scale, on zoom_timer once zoom has returned
+  void finish_zoom();
+
+  /* Render superpixel */
+  // pre: global mutex is locked
+  // the task of p, moving its cache lookup off the GUI thread
+  render_task take_task(superpixel &p);
+  void render_superpixel(const render_task &task, superpixel &result_spot, size_t worker);
+
+  /* Other utils */
+  // pre: global mutex is locked
+  QPoint superpixel2screen(const superpixel &p) const;
+  // pick kernel for current camera view (reference orbit is shared by all of its superpixels)
+  // pre: global mutex is locked
+  void update_line_getter();
+  // pre: global mutex is locked
+  // upper left corner of the superpixel containing pt: superpixels of a zoom level lie on a grid
+  // fixed in absolute coordinates, so they are found in the tile cache from any view
+  QPointF grid_corner(QPointF pt) const;
+  // pre: global mutex is locked
+  tile_cache::key cache_key(QPointF ul_corner) const;
+
+  /* Input version */
+  size_t input_version = superpixel::INPUT_VERSION::NORMAL;
+
+  /* Location in space data */
+  camera cam;
+  // defaults until the calibration, run off the GUI thread, is done; then taken by update_line_getter
+  kernel_tiers tiers;
+  std::future<kernel_tiers> calibration = std::async(std::launch::async, [] { return kernel_tiers::calibrated(); });
+  tile_pyramid<float, superpixel_size> pyramid;  // superpixels left the screen
+  tile_cache disk_cache{QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("tiles")};
+  qreal superpixel_scale = superpixel_size * cam.get_pixel_scale();
+  escape_time::settings kernel_settings;
+  view_kernel view_line_getter;
+
+  /* Workers & superpixels storage */
+  // number of multithreaded workers
+  const unsigned N_WORKERS = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> workers;
+  intrusive::list<superpixel, task_pool_tag> pixel_pool;
+  size_t pool_size = 1;
+  tile_grid<superpixel> screen;  // (cached) screen
+  QPointF grid_origin;           // upper left corner of tile (0, 0), set while the grid is empty
+  typename tile_grid<superpixel>::range visible_tiles;  // of the physical screen
+  QPointF focus_posf = {0.5, 0.5};
+  int focus_x = 0, focus_y = 0;  // tile under focus_posf
+  std::vector<std::unique_ptr<superpixel[]>> allocated_pixels;
+  task_queue_t task_queue{N_WORKERS};
+
+  std::vector<completion> completed;  // since the last flush_output, cleared by input changes (they redraw all)
+  bool is_flush_queued = false;
+  size_t pending_drafts = 0;        // drafts the pending redraw waits for, not rendered yet
+  bool is_redraw_pending = false;   // input changes since the last output_redraw wait for their drafts
+  QTimer draft_timer;               // the draft deadline of the pending redraw
+  bool is_zoom_pending = false;     // the camera is zoomed, the screen still has the superpixels of the old scale
+  std::chrono::steady_clock::time_point zoom_since;  // of the first zoom finish_zoom is pending for
+  QTimer zoom_timer;                // runs finish_zoom
+  size_t added_pixels = 0;          // number of added pixels on current input change
+  size_t new_pixels = 0;            // number of superpixels allocated on current input change
+  bool is_first_pixel_pending = false;  // input changes since first_pixel_since have not got a new superpixel drawn
+  std::chrono::steady_clock::time_point first_pixel_since;
+  size_t first_pixel_wave = 0;      // superpixels added since first_pixel_since have it
+  bool wait_drafts = true;          // current input change waits for drafts until the deadline, otherwise they are streamed
+  mutable std::mutex m;             // global lock
+  mutable std::unique_lock<std::mutex> lg = std::unique_lock(m, std::defer_lock);
+};
+
+// pre: global mutex is locked
+template<int SizePow>
+template<class ratio>
+auto mapper_engine<SizePow>::screen_tiles() const -> typename tile_grid<superpixel>::range
+{
+  // as camera::intersects_x/y: tile x spans [corner, corner + superpixel_scale], both ends included
+  const qreal factor = (ratio::num * 1.0 / ratio::den - 1) * 0.5;
+  const qreal dx = factor * cam.screen.width(), dy = factor * cam.screen.height();
+  auto first = [this](qreal from, qreal origin) {
+    return static_cast<int>(std::ceil((from - origin) / superpixel_scale)) - 1;
+  };
+  auto end = [this](qreal to, qreal origin) {
+    return static_cast<int>(std::floor((to - origin) / superpixel_scale)) + 1;
+  };
+  return {first(cam.screen.left() - dx, grid_origin.x()), first(cam.screen.top() - dy, grid_origin.y()),
+          end(cam.screen.right() + dx, grid_origin.x()), end(cam.screen.bottom() + dy, grid_origin.y())};
+}
@@ -1,100 +1,64 @@
-#include <complex>
+#include <cstdlib>
+#include <unordered_set>
 
-#include "mapper_enterprise.h"
+#include "escape_time.h"
+#include "mapper_engine.h"
 
-static int calc_mandelbrot(std::complex<qreal> Z)
+template<int SizePow>
+mapper_engine<SizePow>::mapper_engine()
 {
-  int n;
-  std::complex<qreal> Z0 = Z;
-  for (n = 0; n < 255 && std::norm(Z) < 4; n++, Z = Z * Z + Z0)
-    ;
-  return n;
-}
-
-static pixel_helper::color float2color(qreal X)
-{
-  using color = pixel_helper::color;
-  qreal c = X;
-  c = c * (2 - c);
-  c = fmod(c * 7 * 3, 7);
-
-  switch (static_cast<int>(c))
-  {
-  case 0:
-    return color(c, 0, 0);
-  case 1:
-    return color(1, c - 1, 0);
-  case 2:
-    return color(3 - c, 1, 0);
-  case 3:
-    return color(0, 1, c - 3);
-  case 4:
-    return color(0, 5 - c, 1);
-  case 5:
-    return color(c - 5, 0, 1);
-  default:
-    return color(1, c - 6, 1);
-  }
-}
-
-pixel_helper::color mapper_enterprise::pixel_getter(QPointF pt)
-{
-  return float2color(calc_mandelbrot({pt.x(), pt.y()}) / 255.0);
-}
+  draft_timer.setSingleShot(true);
+  connect(&draft_timer, &QTimer::timeout, this, [this] { release_drafts(); });
+  zoom_timer.setSingleShot(true);
+  connect(&zoom_timer, &QTimer::timeout, this, [this] { finish_zoom(); });
 
-mapper_enterprise::superpixel_base::superpixel_base(const superpixel_base &other) noexcept
-    : base_t(other), input_version(other.input_version.load()), is_draft(other.is_draft)
-{
-}
-
-mapper_enterprise::superpixel_base &mapper_enterprise::superpixel_base::operator=(const superpixel_base &other) noexcept
-{
-  if (&other != this)
-  {
-    base_t::operator=(other);
-    input_version.store(other.input_version);
-    is_draft = other.is_draft;
-  }
-  return *this;
-}
-
-mapper_enterprise::mapper_enterprise()
-{
   std::lock_guard lglg(lg);
+  update_line_getter();
 
   allocated_pixels.push_back(std::make_unique<superpixel[]>(pool_size));
   for (size_t i = 0; i < pool_size; i++)
     pixel_pool.push_back(allocated_pixels.back()[i]);
+  perf_stats::set(perf_stats::gauge::POOL_SUPERPIXELS, pool_size);
 
   for (int i = 0; i < N_WORKERS; i++)
     workers.emplace_back(std::thread([this, i] {
-      uint64_t last_input_version = 0;
+      trace::set_thread_name("worker " + std::to_string(i));
       for (;;)
       {
-        superpixel_base copy;
-        superpixel *result_spot;
+        render_task task;
+        superpixel *result_spot = &task_queue.pop(i);
         {
           std::unique_lock lg(m);
-          result_spot = &task_queue.pop(lg);
-          copy = *result_spot;
+          // freed or pushed again after popping (the newer task renders it)
+          if (result_spot->input_version == superpixel::INPUT_VERSION::FREE || result_spot->is_tasked())
+          {
+            perf_stats::add(perf_stats::counter::STALE_TASKS);
+            continue;
+          }
+          if (result_spot->input_version == superpixel::INPUT_VERSION::QUIT)
+            break;
+          // the viewport moved away since it was queued: behind the tasks that matter more now
+          if (current_viewport_class(*result_spot) < result_spot->viewport_class)
+          {
+            perf_stats::add(perf_stats::counter::TASKS_REQUEUED);
+            push_task(*result_spot, i);
+            continue;
+          }
+          task = take_task(*result_spot);
         }
 
-        if (copy.input_version == superpixel::INPUT_VERSION::QUIT)
-          break;
-
-        render_superpixel(copy, *result_spot);
+        render_superpixel(task, *result_spot, i);
       }
     }));
 }
 
-mapper_enterprise::~mapper_enterprise()
+template<int SizePow>
+mapper_engine<SizePow>::~mapper_engine()
 {
   std::vector<superpixel> quit(N_WORKERS);
   {
     std::lock_guard lglg(lg);
-    for (auto &row : screen)
-      free_superpixel_row(row);
-    screen.clear();
+    screen.clear([this](superpixel &sq) { free_superpixel(sq); });
     for (int i = 0; i < N_WORKERS; i++)
     {
       quit[i].input_version = superpixel::INPUT_VERSION::QUIT;
@@ -109,28 +73,49 @@ mapper_enterprise::~mapper_enterprise()
 }
 
 // pre: global mutex is locked
-QPoint mapper_enterprise::superpixel2screen(superpixel &p)
+template<int SizePow>
+QPoint mapper_engine<SizePow>::superpixel2screen(const superpixel &p) const
 {
-  QPointF superpixel_ul_corner = screen.front().front().ul_corner;
-  QPoint screen_coord0 = cam.from_point(superpixel_ul_corner), screen_coord = screen_coord0;
+  // measured from one corner, so neighbours stay exactly superpixel_size apart
+  const auto &win = screen.window();
+  QPoint screen_coord0 = cam.from_point(tile_corner(win.x0, win.y0));
+  return {screen_coord0.x() + (p.grid_x - win.x0) * int(superpixel_size),
+          screen_coord0.y() + (p.grid_y - win.y0) * int(superpixel_size)};
+}
 
-  for (auto &row : screen)
-  {
-    for (auto &sq : row)
-    {
-      if (&sq == &p)
-        return screen_coord;
-      screen_coord.setX(screen_coord.x() + superpixel_size);
-    }
-    screen_coord.setX(screen_coord0.x());
-    screen_coord.setY(screen_coord.y() + superpixel_size);
-  }
+// pre: global mutex is locked
+template<int SizePow>
+QPointF mapper_engine<SizePow>::tile_corner(int x, int y) const
+{
+  return grid_origin + QPointF(x * superpixel_scale, y * superpixel_scale);
+}
 
-  return screen_coord;
+// pre: global mutex is locked
+template<int SizePow>
+void mapper_engine<SizePow>::update_screen_grid()
+{
+  // an empty grid is laid out from the grid corner at the screen
+  if (screen.window().is_empty())
+    grid_origin = grid_corner(cam.screen.topLeft());
+  // new superpixels are queued with the classes of the new viewport
+  update_viewport();
+  // kept superpixels and the screen make a rectangle, so no holes are left between them when the screen
+  // jumps over the border of the cached ones
+  auto next = screen.window().intersected(screen_tiles<std::ratio<3, 2>>()).united(screen_tiles<std::ratio<1, 1>>());
+  screen.move(
+      next, [this](superpixel &sq) { free_superpixel(sq); },
+      [this](int x, int y) -> superpixel & {
+        superpixel &res = allocate_superpixel(tile_corner(x, y), superpixel_scale);
+        res.grid_x = x;
+        res.grid_y = y;
+        return res;
+      });
 }
 
-void mapper_enterprise::notify_output(mapper_enterprise::superpixel *p, size_t input_version)
+template<int SizePow>
+void mapper_engine<SizePow>::flush_output()
 {
+  std::vector<output_tile> tiles;
   bool unlock = false;
   if (!lg.owns_lock())
   {
@@ -140,18 +125,76 @@ void mapper_enterprise::notify_output(mapper_enterprise::superpixel *p, size_t i
     lg.lock();
     unlock = true;
   }
-  if (p->input_version == input_version && !p->is_draft)
+  is_flush_queued = false;
+  // the last completion of a superpixel has its current level, older ones are superseded;
+  // superpixels of the scale before a zoom are not drawn over its preview
+  std::unordered_set<superpixel *> seen;
+  for (auto it = completed.rbegin(); it != completed.rend() && !is_zoom_pending; ++it)
   {
-    QPoint coords = superpixel2screen(*p);
-    emit output_update(p->get_mip_data(), coords.x(), coords.y(), superpixel_size >> p->last_mip_level,
-                       p->last_mip_level);
+    superpixel *p = it->p;
+    if (!seen.insert(p).second || p->input_version != it->input_version || p->is_draft)
+      continue;
+    tiles.push_back(output(*p));
   }
+  completed.clear();
   if (unlock)
     lg.unlock();
+
+  if (!tiles.empty())
+    emit output_update(tiles);
 }
 
 // pre: global mutex is locked
-mapper_enterprise::superpixel &mapper_enterprise::allocate_superpixel(QPointF ul_corner, qreal scale)
+template<int SizePow>
+auto mapper_engine<SizePow>::output(const superpixel &p) -> output_tile
+{
+  // off-screen ones are not drawn
+  if (is_first_pixel_pending && p.first_pixel_wave == first_pixel_wave && visible_tiles.contains(p.grid_x, p.grid_y))
+  {
+    perf_stats::record(perf_stats::histogram::FIRST_PIXEL_LATENCY, std::chrono::steady_clock::now() - first_pixel_since);
+    is_first_pixel_pending = false;
+  }
+  QPoint coords = superpixel2screen(p);
+  return {p.get_mip_buffer(), coords.x(), coords.y(), int(superpixel_size >> p.last_mip_level), p.last_mip_level,
+          kernel_settings.max_iterations};
+}
+
+// pre: global mutex is locked
+template<int SizePow>
+void mapper_engine<SizePow>::update_line_getter()
+{
+  // from a new view on, so the superpixels of one view share a tier
+  if (calibration.valid() && calibration.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    tiers = calibration.get();
+  view_line_getter = view_kernel::create(tiers, cam.origin_x, cam.origin_y, cam.get_pixel_scale(), kernel_settings);
+}
+
+// pre: global mutex is locked
+template<int SizePow>
+QPointF mapper_engine<SizePow>::grid_corner(QPointF pt) const
+{
+  dd_real x = tile_cache::grid_floor(cam.origin_x + pt.x(), superpixel_scale) * superpixel_scale - cam.origin_x;
+  dd_real y = tile_cache::grid_floor(cam.origin_y + pt.y(), superpixel_scale) * superpixel_scale - cam.origin_y;
+  return {static_cast<qreal>(x), static_cast<qreal>(y)};
+}
+
+// pre: global mutex is locked
+template<int SizePow>
+tile_cache::key mapper_engine<SizePow>::cache_key(QPointF ul_corner) const
+{
+  tile_cache::key res;
+  res.zoom_level = cam.zoom_level;
+  res.max_iterations = kernel_settings.max_iterations;
+  res.formula = kernel_settings.formula_id();
+  res.tile_size = superpixel_size;
+  res.x = tile_cache::grid_round(cam.origin_x + ul_corner.x(), superpixel_scale);
+  res.y = tile_cache::grid_round(cam.origin_y + ul_corner.y(), superpixel_scale);
+  return res;
+}
+
+// pre: global mutex is locked
+template<int SizePow>
+auto mapper_engine<SizePow>::allocate_superpixel(QPointF ul_corner, qreal scale) -> superpixel &
 {
   if (pixel_pool.empty())
   {
@@ -159,130 +202,462 @@ mapper_enterprise::superpixel &mapper_enterprise::allocate_superpixel(QPointF ul
     for (size_t i = 0; i < pool_size; i++)
       pixel_pool.push_back(allocated_pixels.back()[i]);
     pool_size *= 2;
+    // pools double: pool_size is the number of superpixels allocated so far
+    perf_stats::set(perf_stats::gauge::POOL_SUPERPIXELS, pool_size);
   }
 
   superpixel &p = pixel_pool.front();
   pixel_pool.pop_front();
   p.ul_corner = ul_corner;
   p.scale = scale;
+  p.grid = superpixel::sample_grid::NESTED;
+  p.mode = superpixel::render_mode::SUBDIVIDE;
+  p.set_func(view_line_getter);
   p.input_version = input_version;
   p.set_mip_level(draft_mip_level);
-  p.is_draft = true;
-  task_queue.push(p);
-  added_pixels++;
+  p.cache_key = cache_key(ul_corner);
+  p.first_pixel_wave = first_pixel_wave;
+  new_pixels++;
+
+  // rendered before: reuse it without a worker pass, from memory as it is; reading it from disk or
+  // assembling it from the superpixels covering the same place one octave coarser or finer is left to
+  // the worker taking its task
+  if (auto kept = pyramid.take(p.cache_key))
+    p.publish(kept->mip_level, std::move(kept->data));
+  p.is_cache_pending = p.get_mip_data() == nullptr;
+
+  if (p.get_mip_data() != nullptr)
+    perf_stats::add(perf_stats::counter::SUPERPIXELS_REUSED);
+  // without waiting, drafts are shown as they come
+  p.is_draft = wait_drafts && p.get_mip_data() == nullptr;
+  if (p.is_draft)
+  {
+    added_pixels++;
+    pending_drafts++;
+  }
+  if (p.last_mip_level != 0)
+    push_task(p);
   return p;
 }
 
 // pre: global mutex is locked
-void mapper_enterprise::free_superpixel(mapper_enterprise::superpixel &pixel)
+template<int SizePow>
+void mapper_engine<SizePow>::push_task(superpixel &p, size_t worker)
 {
-  pixel.input_version = input_version;
-  task_queue.erase(pixel);
-  pixel.clear();
-  pixel_pool.push_back(pixel);
+  trace::instant(trace::event::TILE_QUEUED, reinterpret_cast<uintptr_t>(&p), p.last_mip_level - 1);
+  perf_stats::add(perf_stats::counter::SUPERPIXELS_QUEUED);
+  p.viewport_class = current_viewport_class(p);
+  task_queue.push(p, worker);
 }
 
 // pre: global mutex is locked
-void mapper_enterprise::free_superpixel_row(intrusive::list<mapper_enterprise::superpixel, screen_tag> &row)
+template<int SizePow>
+size_t mapper_engine<SizePow>::current_viewport_class(const superpixel &p) const
 {
-  for (auto &sq : row)
-    free_superpixel(sq);
-  row.clear();
+  if (!visible_tiles.contains(p.grid_x, p.grid_y))
+    return 0;
+  int dist = std::max(std::abs(p.grid_x - focus_x), std::abs(p.grid_y - focus_y));
+  return dist >= focus_rings ? 1 : viewport_classes - 1 - dist;
+}
+
+// pre: global mutex is locked
+template<int SizePow>
+void mapper_engine<SizePow>::update_viewport()
+{
+  visible_tiles = screen_tiles<std::ratio<1, 1>>();
+  QPointF focus_pt = cam.screen.topLeft() - grid_origin +
+                     QPointF(focus_posf.x() * cam.screen.width(), focus_posf.y() * cam.screen.height());
+  focus_x = static_cast<int>(std::floor(focus_pt.x() / superpixel_scale));
+  focus_y = static_cast<int>(std::floor(focus_pt.y() / superpixel_scale));
+}
+
+// pre: global mutex is locked
+template<int SizePow>
+void mapper_engine<SizePow>::raise_visible_tasks()
+{
+  const auto visible = screen.window().intersected(visible_tiles);
+  for (int y = visible.y0; y < visible.y1; y++)
+    for (int x = visible.x0; x < visible.x1; x++)
+    {
+      superpixel &sq = screen.at(x, y);
+      if (sq.is_tasked() && current_viewport_class(sq) > sq.viewport_class)
+      {
+        perf_stats::add(perf_stats::counter::TASKS_REQUEUED);
+        push_task(sq);
+      }
+    }
+}
+
+// pre: global mutex is locked
+template<int SizePow>
+void mapper_engine<SizePow>::free_superpixel(superpixel &pixel)
+{
+  pixel.input_version = superpixel::INPUT_VERSION::FREE;
+  // the pending redraw does not wait for it any more
+  if (pixel.is_draft)
+  {
+    pixel.is_draft = false;
+    pending_drafts--;
+  }
+  task_queue.erase(pixel);
+  if (pixel.get_mip_data() != nullptr)
+    pyramid.put(pixel.cache_key, {pixel.get_mip_buffer(), pixel.last_mip_level});
+  pixel.clear();
+  pixel.set_func({});  // release reference orbit
+  pixel_pool.push_back(pixel);
 }
 
 // pre: global mutex is locked (unlocks)
-void mapper_enterprise::update_screen()
+template<int SizePow>
+void mapper_engine<SizePow>::update_screen(bool wait_drafts)
 {
-  update_screen_func<false>();
+  trace::scope span(trace::event::UPDATE_SCREEN);
+  // a zoom counts from the zoom, not from finish_zoom
+  const auto start = is_zoom_pending ? zoom_since : std::chrono::steady_clock::now();
+  is_zoom_pending = false;
+  zoom_timer.stop();
+  this->wait_drafts = wait_drafts;
+  completed.clear();  // output_redraw shows them
   added_pixels = 0;
-  update_screen_func<true>();
+  new_pixels = 0;
+  // superpixels of a new wave are added unless an earlier input change still waits for its first one
+  if (!is_first_pixel_pending)
+    first_pixel_wave++;
+  update_screen_grid();
+  raise_visible_tasks();
   // pull all resources to draft
   if (added_pixels > 0)
-    for (auto &row : screen)
-      for (auto &sq : row)
-        if (!sq.is_tasked && sq.last_mip_level != 0)
-        {
-          // sq is being rendered right now, push it off
-          sq.input_version = input_version;
-          task_queue.push(sq);
-        }
+    screen.for_each([this](int, int, superpixel &sq) {
+      if (!sq.is_tasked() && sq.last_mip_level != 0)
+      {
+        // sq is being rendered right now, push it off
+        sq.input_version = input_version;
+        push_task(sq);
+      }
+    });
   ++input_version;
 
-  auto begin = std::chrono::high_resolution_clock::now();
-  rendered_drafts.wait(lg, added_pixels);
+  // first pixel latency counts from the earliest input change still waiting for a new superpixel
+  if (new_pixels > 0 && !is_first_pixel_pending)
+  {
+    is_first_pixel_pending = true;
+    first_pixel_since = start;
+  }
+  // the redraw waits for the drafts of the input changes since the last one, until the deadline of the first;
+  // the GUI thread goes on meanwhile, release_drafts emits it
+  const bool is_redraw_due = pending_drafts == 0;
+  if (is_redraw_due)
+  {
+    is_redraw_pending = false;
+    draft_timer.stop();
+  }
+  else if (!is_redraw_pending)
+  {
+    is_redraw_pending = true;
+    draft_timer.start(std::max(std::chrono::milliseconds(0), std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                                 start + draft_deadline - std::chrono::steady_clock::now())));
+  }
   lg.unlock();
-  auto dt = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - begin).count();
-  if (dt > 20)
-    my_log::println("Update took " + std::to_string(dt) + "ms");
-  emit output_redraw();
+  if (trace::is_enabled())
+  {
+    memory_usage usage = get_memory_usage();
+    trace::counter(trace::event::SUPERPIXEL_BYTES, usage.superpixel_bytes);
+    trace::counter(trace::event::PYRAMID_BYTES, usage.pyramid_bytes);
+    trace::counter(trace::event::ARENA_BYTES, usage.arena_resident_bytes);
+  }
+  if (is_redraw_due)
+    emit output_redraw();
 }
 
-void mapper_enterprise::pan(QPointF mdposf)
+template<int SizePow>
+void mapper_engine<SizePow>::release_drafts()
 {
-  auto begin = std::chrono::high_resolution_clock::now();
-  cam.pan(mdposf);
+  bool unlock = false;
+  if (!lg.owns_lock())
   {
+    // called from the event queue only, locked as by flush_output
     lg.lock();
-    update_screen();
+    unlock = true;
+  }
+  // drafts of a later input change came meanwhile: the draft timer still runs for them
+  if (!is_redraw_pending || (pending_drafts > 0 && draft_timer.isActive()))
+  {
+    if (unlock)
+      lg.unlock();
+    return;
+  }
+  is_redraw_pending = false;
+  draft_timer.stop();
+  if (pending_drafts > 0)
+  {
+    // missed the frame: the rest are placeholders until flush_output
+    screen.for_each([](int, int, superpixel &sq) { sq.is_draft = false; });
+    pending_drafts = 0;
+    perf_stats::add(perf_stats::counter::MISSED_DEADLINES);
   }
-  auto dt = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - begin).count();
-  if (dt > 20)
-    my_log::println("Pan took " + std::to_string(dt) + "ms");
+  if (unlock)
+    lg.unlock();
+
+  emit output_redraw();
+}
+
+template<int SizePow>
+void mapper_engine<SizePow>::pan(QPointF mdposf)
+{
+  cam.pan(mdposf);
+  lg.lock();
+  // finish_zoom builds the screen for the camera as it is then
+  if (is_zoom_pending)
+    lg.unlock();
+  else
+    update_screen();
+}
+
+// pre: global mutex is locked (unlocks)
+template<int SizePow>
+void mapper_engine<SizePow>::rerender_screen(bool wait_drafts)
+{
+  screen.clear([this](superpixel &sq) { free_superpixel(sq); });
+  update_line_getter();
+  update_screen(wait_drafts);
 }
 
-void mapper_enterprise::zoom(QPointF mposf, int delta)
+template<int SizePow>
+qreal mapper_engine<SizePow>::zoom(QPointF mposf, int delta)
 {
+  perf_stats::timer zoom_time(perf_stats::histogram::ZOOM_TIME);
+  qreal old_pixel_scale = cam.get_pixel_scale();
   if (!cam.zoom(mposf, delta))
-    return;
+    return 1;
+  std::lock_guard lglg(lg);
   superpixel_scale = superpixel_size * cam.get_pixel_scale();
+  // the zoom focus is rendered first
+  focus_posf = mposf;
+  // freeing the screen and queueing the new one take a while with many superpixels, so they are left to
+  // finish_zoom: a timer, run after the caller's preview is painted, once for a burst of zooms
+  if (!is_zoom_pending)
   {
-    lg.lock();
-    for (auto &row : screen)
-      free_superpixel_row(row);
-    screen.clear();
-    update_screen();
+    is_zoom_pending = true;
+    zoom_since = std::chrono::steady_clock::now();
+    zoom_timer.start(0);
   }
+  return cam.get_pixel_scale() / old_pixel_scale;
 }
 
-void mapper_enterprise::resize(QSize size)
+template<int SizePow>
+void mapper_engine<SizePow>::finish_zoom()
+{
+  lg.lock();
+  if (is_zoom_pending)
+    rerender_screen(false);
+  else
+    lg.unlock();  // rerendered by a settings change meanwhile
+}
+
+template<int SizePow>
+void mapper_engine<SizePow>::resize(QSize size)
 {
   cam.resize(size);
-  {
-    lg.lock();
+  lg.lock();
+  if (is_zoom_pending)
+    lg.unlock();  // as by pan
+  else
     update_screen();
-  }
 }
 
-void mapper_enterprise::change_draft_mip_level(int new_draft_mip_level)
+template<int SizePow>
+void mapper_engine<SizePow>::change_draft_mip_level(int new_draft_mip_level)
+{
+  std::lock_guard lglg(lg);
+  draft_mip_level = std::min(new_draft_mip_level, max_draft_mip_level);
+}
+
+template<int SizePow>
+void mapper_engine<SizePow>::change_draft_deadline(int new_draft_deadline_ms)
 {
   std::lock_guard lglg(lg);
-  draft_mip_level = new_draft_mip_level;
+  draft_deadline = std::chrono::milliseconds(new_draft_deadline_ms);
 }
 
-void mapper_enterprise::render_superpixel(mapper_enterprise::superpixel_base &pixel, mapper_enterprise::superpixel &result_spot)
+template<int SizePow>
+void mapper_engine<SizePow>::change_kernel_settings(escape_time::settings new_settings)
 {
-  if (!pixel.render_mip_level([&] { return pixel.input_version != result_spot.input_version; }))
+  lg.lock();
+  if (new_settings == kernel_settings)
+  {
+    lg.unlock();
     return;
+  }
+  kernel_settings = new_settings;
+  rerender_screen();
+}
+
+template<int SizePow>
+void mapper_engine<SizePow>::focus(QPointF mposf)
+{
+  std::lock_guard lglg(lg);
+  focus_posf = mposf;
+  if (is_zoom_pending)
+    return;  // the grid is of the old scale, finish_zoom takes focus_posf
+  const int old_x = focus_x, old_y = focus_y;
+  update_viewport();
+  if (focus_x != old_x || focus_y != old_y)
+    raise_visible_tasks();
+}
+
+template<int SizePow>
+escape_time::settings mapper_engine<SizePow>::get_kernel_settings() const
+{
+  std::lock_guard lglg(lg);
+  return kernel_settings;
+}
+
+template<int SizePow>
+mapper_enterprise::memory_usage mapper_engine<SizePow>::get_memory_usage() const
+{
+  memory_usage res;
+  {
+    std::lock_guard lglg(lg);
+    screen.for_each([&res](int, int, const superpixel &sq) {
+      res.superpixels++;
+      res.superpixel_bytes += sq.resident_bytes();
+    });
+  }
+  res.pyramid_bytes = pyramid.bytes();
+  res.arena_resident_bytes = slab_arena::global().resident_bytes();
+  return res;
+}
+
+template<int SizePow>
+void mapper_engine<SizePow>::sample_stats() const
+{
+  // by mip level, summing viewport classes
+  for (size_t level_prior = 0; level_prior <= max_draft_mip_level; level_prior++)
+  {
+    size_t depth = 0;
+    for (size_t cls = 0; cls < viewport_classes; cls++)
+      depth += task_queue.size(level_prior * viewport_classes + cls);
+    perf_stats::set_queue_depth(level_prior, depth);
+  }
+  memory_usage usage = get_memory_usage();
+  perf_stats::set(perf_stats::gauge::SCREEN_SUPERPIXELS, usage.superpixels);
+  perf_stats::set(perf_stats::gauge::SUPERPIXEL_BYTES, usage.superpixel_bytes);
+  perf_stats::set(perf_stats::gauge::PYRAMID_BYTES, usage.pyramid_bytes);
+  perf_stats::set(perf_stats::gauge::ARENA_BYTES, usage.arena_resident_bytes);
+}
+
+// pre: global mutex is locked
+template<int SizePow>
+auto mapper_engine<SizePow>::take_task(superpixel &p) -> render_task
+{
+  render_task res{p.next_job(), p.input_version, p.cache_key};
+  if (p.is_cache_pending)
+  {
+    p.is_cache_pending = false;
+    res.is_cache_lookup = true;
+    // only the tiles are found under the lock, they are copied after it
+    pyramid.assemble(p.cache_key, res.job.mip_level, [&res](int mip_level, auto &&copy) {
+      res.assembled_mip_level = mip_level;
+      res.assemble = copy;
+      return true;
+    });
+  }
+  return res;
+}
+
+template<int SizePow>
+void mapper_engine<SizePow>::render_superpixel(const render_task &task,
+                                          superpixel &result_spot, size_t worker)
+{
+  const uintptr_t trace_id = reinterpret_cast<uintptr_t>(&result_spot);
+  std::shared_ptr<const typename superpixel_base::mip_buffer> data;
+  int mip_level = task.job.mip_level;
+  if (task.is_cache_lookup)
+  {
+    data = superpixel_base::filled(0, [&](float *out, size_t bytes) { return disk_cache.load(task.cache_key, out, bytes); });
+    if (data != nullptr)
+      mip_level = 0;
+    else if (task.assemble)
+    {
+      mip_level = task.assembled_mip_level;
+      data = superpixel_base::filled(mip_level, [&](float *out, size_t) {
+        task.assemble(out);
+        return true;
+      });
+    }
+  }
+  const bool is_reused = data != nullptr;
+  if (is_reused)
+    perf_stats::add(perf_stats::counter::SUPERPIXELS_REUSED);
+  else
+  {
+    trace::begin(trace::event::TILE_RENDER, trace_id, task.job.mip_level);
+    const auto start = std::chrono::steady_clock::now();
+    data = task.job.render([&] { return task.input_version != result_spot.input_version; });
+    perf_stats::record(perf_stats::histogram::RENDER_TIME, std::chrono::steady_clock::now() - start);
+    trace::end(trace::event::TILE_RENDER, trace_id, task.job.mip_level);
+    if (data == nullptr)
+    {
+      trace::instant(trace::event::TILE_CANCELLED, trace_id, task.job.mip_level);
+      perf_stats::add(perf_stats::counter::SUPERPIXELS_CANCELLED);
+      return;
+    }
+  }
   {
     std::unique_lock lg(m);
-    if (pixel.input_version != result_spot.input_version)
+    if (task.input_version != result_spot.input_version)
+    {
+      trace::instant(trace::event::TILE_CANCELLED, trace_id, mip_level);
+      perf_stats::add(perf_stats::counter::SUPERPIXELS_CANCELLED);
       return;
-    assert(pixel.last_mip_level >= -1);
-    result_spot.copy_mip_data(pixel);
+    }
+    result_spot.publish(mip_level, data);
+    trace::instant(trace::event::TILE_PUBLISHED, trace_id, mip_level);
+    if (!is_reused)
+      perf_stats::add(perf_stats::counter::SUPERPIXELS_RENDERED);
+    // not a draft any more if update_screen missed its deadline since the task was taken
+    bool was_draft = result_spot.is_draft;
     result_spot.is_draft = false;
-    if (pixel.last_mip_level != 0)
-      task_queue.push(result_spot);  // can rerender with higher quality
-    if (!pixel.is_draft)
+    if (mip_level != 0)
+      push_task(result_spot, worker);  // can rerender with higher quality
+    if (!was_draft)
     {
-      size_t input_version = result_spot.input_version;
-      mapper_enterprise::superpixel *spot = &result_spot;
-      // screen updated
-      QMetaObject::invokeMethod(this, "notify_output", Qt::QueuedConnection,
-                                Q_ARG(mapper_enterprise::superpixel *, spot),
-                                Q_ARG(size_t, input_version));
+      // screen updated: batched into one queued flush until the GUI thread takes them
+      completed.push_back({&result_spot, result_spot.input_version});
+      if (!is_flush_queued)
+      {
+        is_flush_queued = true;
+        QMetaObject::invokeMethod(this, "flush_output", Qt::QueuedConnection);
+      }
     }
-    else
-      // rendered draft pixel
-      rendered_drafts.increment(lg);
+    else if (--pending_drafts == 0 && is_redraw_pending)
+      // the last draft the redraw waits for
+      QMetaObject::invokeMethod(this, "release_drafts", Qt::QueuedConnection);
   }
+  if (mip_level == 0 && !is_reused)
+    disk_cache.store(task.cache_key, data.get(), superpixel_base::mip_level_bytes(0));
+}
+
+template<int SizePow>
+void mapper_engine<SizePow>::visit_output(const std::function<void(const output_tile &)> &func)
+{
+  // cut out cached screen and show only physical
+  std::lock_guard lglg(lg);
+  if (is_zoom_pending)
+    return;  // as by flush_output
+  const auto visible = screen.window().intersected(screen_tiles<std::ratio<1, 1>>());
+  for (int y = visible.y0; y < visible.y1; y++)
+    for (int x = visible.x0; x < visible.x1; x++)
+    {
+      superpixel &sq = screen.at(x, y);
+      if (sq.get_mip_data() != nullptr)
+        func(output(sq));
+    }
+}
+
+std::unique_ptr<mapper_enterprise> mapper_enterprise::create(int superpixel_size_pow)
+{
+  return tile_size::dispatch(superpixel_size_pow, [](auto size_pow) -> std::unique_ptr<mapper_enterprise> {
+    return std::make_unique<mapper_engine<decltype(size_pow)::value>>();
+  });
 }
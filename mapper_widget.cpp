@@ -1,20 +1,91 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <fstream>
+#include <thread>
+#include <unordered_set>
 #include <QEvent>
+#include <QGuiApplication>
+#include <QKeyEvent>
 #include <QPainter>
+#include <QScreen>
+#include <QSettings>
 #include <QMouseEvent>
 #include <QTimer>
+#include <QWindow>
 
+#include "blit.h"
 #include "mapper_widget.h"
+#include "tile_tuning.h"
+#include "trace.h"
 
 mapper_widget::mapper_widget(QWidget *parent) : QWidget(parent)
 {
   ui.setupUi(this);
-  connect(&worker, &mapper_enterprise::output_update, this, &mapper_widget::part_image_update);
-  connect(&worker, &mapper_enterprise::output_redraw, this, &mapper_widget::full_image_update);
+  trace::set_thread_name("gui");
+  connect(worker.get(), &mapper_enterprise::output_update, this, &mapper_widget::part_image_update);
+  // queued: zoom returns before drawing the superpixels it has got ready
+  connect(worker.get(), &mapper_enterprise::output_redraw, this, &mapper_widget::full_image_update, Qt::QueuedConnection);
+
+  // keys toggle the stats overlay
+  setFocusPolicy(Qt::StrongFocus);
+  // superpixels around the cursor are rendered first
+  setMouseTracking(true);
+  connect(&stats_overlay_timer, &QTimer::timeout, this, &mapper_widget::stats_overlay_tick);
+  stats_log_path = qEnvironmentVariable("MANDELBROT_STATS_LOG");
+  if (!stats_log_path.isEmpty())
+  {
+    stats_log_prev = perf_stats::take();
+    connect(&stats_log_timer, &QTimer::timeout, this, &mapper_widget::stats_log_tick);
+    stats_log_timer.start(stats_log_interval_ms);
+  }
+  tune_superpixel_size();
 }
 
 mapper_widget::~mapper_widget()
-{}
+{
+  if (tile_size_tuner.joinable())
+    tile_size_tuner.join();
+}
+
+// settings key of the auto superpixel size for the available screen size and the cores
+static QString auto_tile_size_key()
+{
+  const QSize screen = QGuiApplication::primaryScreen()->availableSize();
+  return QString("Auto tile size/%1 threads %2x%3")
+      .arg(std::max(1u, std::thread::hardware_concurrency()))
+      .arg(screen.width())
+      .arg(screen.height());
+}
+
+int mapper_widget::startup_superpixel_size_pow()
+{
+  const QString value = qEnvironmentVariable("MANDELBROT_TILE_SIZE");
+  if (value == "auto")
+  {
+    // measured by tune_superpixel_size, the default until then
+    const int size_pow = QSettings("NH5 Software", "Mandelbrot Viewer").value(auto_tile_size_key(), 0).toInt();
+    return tile_size::is_valid(size_pow) ? size_pow : tile_size::default_pow;
+  }
+  const int size_pow = tile_size::parse(value);
+  return tile_size::is_valid(size_pow) ? size_pow : tile_size::default_pow;
+}
+
+void mapper_widget::tune_superpixel_size()
+{
+  const QString key = auto_tile_size_key();
+  if (qEnvironmentVariable("MANDELBROT_TILE_SIZE") != "auto" ||
+      tile_size::is_valid(QSettings("NH5 Software", "Mandelbrot Viewer").value(key, 0).toInt()))
+    return;
+  // renders the screen with every size twice, for the next start: the engine's size is fixed while it runs
+  const QSize screen = QGuiApplication::primaryScreen()->availableSize();
+  const unsigned n_threads = std::max(1u, std::thread::hardware_concurrency());
+  tile_size_tuner = std::thread([screen, n_threads, key] {
+    trace::set_thread_name("tile size tuner");
+    const int size_pow = tile_tuning::pick(tile_tuning::measure_screen(screen, n_threads));
+    QSettings("NH5 Software", "Mandelbrot Viewer").setValue(key, size_pow);
+  });
+}
 
 void mapper_widget::mousePressEvent(QMouseEvent *event) {
   if (event->button() == Qt::LeftButton)
@@ -35,10 +106,49 @@ QPointF mapper_widget::calc_posf(QPoint pos)
 
 void mapper_widget::wheelEvent(QWheelEvent *event)
 {
-  worker.zoom(calc_posf(event->pos()), event->delta() / 120);
+  QPointF posf = calc_posf(event->pos());
+  qreal fac = worker->zoom(posf, event->delta() / 120);
+  if (fac != 1)
+    show_preview(QPointF(posf.x() * width(), posf.y() * height()), fac, {0, 0});
   event->accept();
 }
 
+void mapper_widget::keyPressEvent(QKeyEvent *event)
+{
+  if (event->key() == Qt::Key_F3)
+  {
+    is_stats_overlay_shown = !is_stats_overlay_shown;
+    if (is_stats_overlay_shown)
+    {
+      worker->sample_stats();
+      stats_overlay_prev = stats_overlay_cur = perf_stats::take();
+      stats_overlay_timer.start(stats_overlay_interval_ms);
+    }
+    else
+      stats_overlay_timer.stop();
+    update();
+    event->accept();
+  }
+  else
+    QWidget::keyPressEvent(event);
+}
+
+void mapper_widget::stats_overlay_tick()
+{
+  worker->sample_stats();
+  stats_overlay_prev = std::move(stats_overlay_cur);
+  stats_overlay_cur = perf_stats::take();
+  update();
+}
+
+void mapper_widget::stats_log_tick()
+{
+  worker->sample_stats();
+  perf_stats::snapshot cur = perf_stats::take();
+  perf_stats::dump(stats_log_path, cur, stats_log_prev);
+  stats_log_prev = std::move(cur);
+}
+
 void mapper_widget::mouseReleaseEvent(QMouseEvent *event) {
   if (event->button() == Qt::LeftButton)
   {
@@ -51,10 +161,13 @@ void mapper_widget::mouseReleaseEvent(QMouseEvent *event) {
 }
 
 void mapper_widget::mouseMoveEvent(QMouseEvent *event) {
+  QPoint pt = event->pos();
+  worker->focus(calc_posf(pt));
   if (left_bt_pressed)
   {
-    QPoint pt = event->pos();
-    worker.pan(calc_posf(pt - last_mouse_pos));
+    worker->pan(calc_posf(pt - last_mouse_pos));
+    // superpixels missing the frame deadline are drawn over the moved image as they come
+    show_preview({0, 0}, 1, pt - last_mouse_pos);
     last_mouse_pos = pt;
     event->accept();
   }
@@ -62,48 +175,169 @@ void mapper_widget::mouseMoveEvent(QMouseEvent *event) {
     event->ignore();
 }
 
-// works faster and more stably than QPainter::drawImage(QRect dst, QImage, QRect src)
-void draw_mip(std::vector<pixel_helper::color> &scr_buf, int scr_w, int scr_h,
-              pixel_helper::color *data, int scr_x, int scr_y, int mip_w, int mip_h, int mip_level)
+void mapper_widget::leaveEvent(QEvent *event)
+{
+  worker->focus({0.5, 0.5});
+  QWidget::leaveEvent(event);
+}
+
+// shown where nothing is rendered yet
+static const pixel_helper::color placeholder(uchar(48), uchar(48), uchar(48));
+
+// nearest neighbour zoom of src around anchor (in pixels) moved by shift into dst:
+// dst(p) = src(anchor + (p - anchor) * fac - shift), pixels from outside of src are placeholders
+void resample_preview(std::vector<pixel_helper::color> &dst, const std::vector<pixel_helper::color> &src, int scr_w,
+                      int scr_h, QPointF anchor, qreal fac, QPoint shift)
 {
-  int sq_size = 1 << mip_level;
+  std::vector<int> src_x(scr_w);
+  for (int x = 0; x < scr_w; x++)
+  {
+    int sx = static_cast<int>(std::floor(anchor.x() + (x + 0.5 - anchor.x()) * fac)) - shift.x();
+    src_x[x] = sx >= 0 && sx < scr_w ? sx : -1;
+  }
 
-  for (int i = 0; i < mip_h; i++)
-    for (int k = 0; k < sq_size; k++)
+  for (int y = 0; y < scr_h; y++)
+  {
+    int sy = static_cast<int>(std::floor(anchor.y() + (y + 0.5 - anchor.y()) * fac)) - shift.y();
+    pixel_helper::color *dst_line = dst.data() + y * scr_w;
+    if (sy < 0 || sy >= scr_h)
     {
-      int y = scr_y + i * sq_size + k;
-      if (y >= 0 && y < scr_h)
-        for (int j = 0; j < mip_w; j++)
-          for (int l = 0; l < sq_size; l++)
-          {
-            int x = scr_x + j * sq_size + l;
-            if (x >= 0 && x < scr_w)
-              scr_buf[y * scr_w + x] = data[i * mip_w + j];
-          }
+      std::fill(dst_line, dst_line + scr_w, placeholder);
+      continue;
     }
+    const pixel_helper::color *src_line = src.data() + sy * scr_w;
+    for (int x = 0; x < scr_w; x++)
+      dst_line[x] = src_x[x] != -1 ? src_line[src_x[x]] : placeholder;
+  }
 }
 
-void mapper_widget::paintEvent(QPaintEvent *event)
+// moves the image in place by shift, as resample_preview with fac 1 without a copy: pixels uncovered are placeholders
+void shift_preview(std::vector<pixel_helper::color> &img, int scr_w, int scr_h, QPoint shift)
 {
-  is_update_queued = false;
+  const int dx = shift.x(), dy = shift.y();
+  if (std::abs(dx) >= scr_w || std::abs(dy) >= scr_h)
+  {
+    std::fill(img.begin(), img.end(), placeholder);
+    return;
+  }
+  const int left = std::max(dx, 0), w = scr_w - std::abs(dx);
+  // rows are visited away from the side they move to, so each is moved before it is overwritten
+  for (int i = 0; i < scr_h; i++)
+  {
+    int y = dy > 0 ? scr_h - 1 - i : i, sy = y - dy;
+    pixel_helper::color *line = img.data() + size_t(y) * scr_w;
+    if (sy < 0 || sy >= scr_h)
+    {
+      std::fill(line, line + scr_w, placeholder);
+      continue;
+    }
+    std::memmove(line + left, img.data() + size_t(sy) * scr_w + std::max(-dx, 0), w * sizeof(pixel_helper::color));
+    std::fill(line, line + left, placeholder);
+    std::fill(line + left + w, line + scr_w, placeholder);
+  }
+}
+
+const palette &mapper_widget::palette_for(int max_iterations)
+{
+  if (max_iterations == pal.get_max_iterations())
+    return pal;
+  if (max_iterations != stale_pal.get_max_iterations() || stale_pal.get_period() != pal.get_period())
+    stale_pal = palette(pal.get_period(), max_iterations);
+  return stale_pal;
+}
+
+void mapper_widget::flush_image_updates()
+{
+  if (update_scr_queue.empty())
+    return;
+  // the last update at a screen position supersedes the older ones, which are not even colorized
+  std::unordered_set<uint64_t> seen;
+  std::vector<const mapper_enterprise::output_tile *> live;
+  size_t pixels = 0;
+  for (auto it = update_scr_queue.rbegin(); it != update_scr_queue.rend(); ++it)
+    if (seen.insert(uint64_t(uint32_t(it->x)) << 32 | uint32_t(it->y)).second)
+    {
+      live.push_back(&*it);
+      pixels += size_t(it->size) * it->size;
+    }
+
+  update_colors.resize(pixels);
+  std::vector<mip_blit> blits;
+  blits.reserve(live.size());
+  pixel_helper::color *colors = update_colors.data();
+  for (auto it = live.rbegin(); it != live.rend(); ++it)
+  {
+    const mapper_enterprise::output_tile &tile = **it;
+    palette_for(tile.max_iterations).colorize(colors, tile.data.get(), size_t(tile.size) * tile.size);
+    blits.push_back({colors, tile.x, tile.y, tile.size, tile.size, tile.mip_level});
+    colors += size_t(tile.size) * tile.size;
+  }
+  // full screen updates are drawn on all cores
+  draw_mips(cached_result, width(), height(), blits, &blit_pool);
+  update_scr_queue.clear();
+}
 
-  while (!update_scr_queue.empty())
+void mapper_widget::show_preview(QPointF anchor, qreal fac, QPoint shift)
+{
+  flush_image_updates();
+  if (fac == 1)
+    shift_preview(cached_result, width(), height(), shift);  // a pan, on every mouse move while dragging
+  else
   {
-    update_scr_query query = std::move(update_scr_queue.front());
-    update_scr_queue.pop_front();
-    draw_mip(cached_result, width(), height(), query.data.data(), query.scr_x, query.scr_y, query.mip_w, query.mip_h,
-             query.mip_level);
+    // copied, cached_image keeps the buffer
+    preview_source.assign(cached_result.begin(), cached_result.end());
+    resample_preview(cached_result, preview_source, width(), height(), anchor, fac, shift);
   }
+  update();
+}
+
+void mapper_widget::paintEvent(QPaintEvent *event)
+{
+  trace::scope span(trace::event::PAINT);
+  perf_stats::timer frame_time(perf_stats::histogram::FRAME_TIME);
+  perf_stats::add(perf_stats::counter::FRAMES);
 
-  // full_image_update();
+  // only the parts updated since the last paint; cached_image is in the native format of the raster engine
   QPainter p(this);
-  p.drawImage(event->rect(), QImage((uchar *)cached_result.data(), width(), height(), width() * 3, QImage::Format_RGB888));
+  for (const QRect &r : event->region())
+    p.drawImage(r.topLeft(), cached_image, r);
+  if (is_stats_overlay_shown)
+    draw_stats_overlay(p);
+}
+
+// pre: p paints this widget
+void mapper_widget::draw_stats_overlay(QPainter &p)
+{
+  static constexpr int margin = 8, line_height = 16, overlay_width = 560;
+  std::vector<QString> lines = perf_stats::format(stats_overlay_cur, stats_overlay_prev);
+  const int overlay_height = static_cast<int>(lines.size()) * line_height + 2 * margin;
+  p.fillRect(QRect(margin, margin, overlay_width, overlay_height), QColor(0, 0, 0, 160));
+  QFont font("Monospace");
+  font.setStyleHint(QFont::Monospace);
+  p.setFont(font);
+  p.setPen(QColor(255, 255, 255));
+  for (size_t i = 0; i < lines.size(); i++)
+    p.drawText(QRect(2 * margin, 2 * margin + static_cast<int>(i) * line_height, overlay_width - 2 * margin, line_height),
+               Qt::AlignLeft | Qt::AlignVCenter, lines[i]);
 }
 
 void mapper_widget::resizeEvent(QResizeEvent *event)
 {
-  cached_result.resize(event->size().width() * event->size().height());
-  worker.resize(event->size());
+  // keep the image at the upper left corner, as the camera does
+  flush_image_updates();
+  QSize old_size = event->oldSize(), size = event->size();
+  preview_source.swap(cached_result);
+  cached_result.assign(size.width() * size.height(), placeholder);
+  if (old_size.isValid() && preview_source.size() == size_t(old_size.width() * old_size.height()))
+  {
+    int w = std::min(old_size.width(), size.width()), h = std::min(old_size.height(), size.height());
+    for (int y = 0; y < h; y++)
+      std::copy(preview_source.begin() + y * old_size.width(), preview_source.begin() + y * old_size.width() + w,
+                cached_result.begin() + y * size.width());
+  }
+  cached_image = QImage(reinterpret_cast<uchar *>(cached_result.data()), size.width(), size.height(),
+                        size.width() * static_cast<int>(sizeof(pixel_helper::color)), QImage::Format_RGB32);
+  worker->resize(size);
 }
 
 int round_up_mip_level(int x, int mip_size, int mip_level)
@@ -115,31 +349,67 @@ void mapper_widget::full_image_update()
 {
   update_scr_queue.clear();
 
-  worker.visit_output([&](pixel_helper::color *data, int scr_x, int scr_y, int mip_size, int mip_level) {
-    update_scr_query query = update_scr_query(scr_x, scr_y, mip_size, mip_size, mip_level);
-    std::copy(data, data + query.data.size(), query.data.begin());
-    update_scr_queue.push_back(std::move(query));
-  });
-  if (!is_update_queued)
-  {
-    is_update_queued = true;
-    QTimer::singleShot(10, this, SLOT(update()));
-  }
+  worker->visit_output([&](const mapper_enterprise::output_tile &tile) { update_scr_queue.push_back(tile); });
+  queue_image_updates();
 }
 
-void mapper_widget::part_image_update(pixel_helper::color *data, int scr_x, int scr_y, int mip_size, int mip_level)
+void mapper_widget::part_image_update(const std::vector<mapper_enterprise::output_tile> &tiles)
 {
-  update_scr_query query = update_scr_query(scr_x, scr_y, mip_size, mip_size, mip_level);
-  std::copy(data, data + query.data.size(), query.data.begin());
-  update_scr_queue.push_back(std::move(query));
-  if (!is_update_queued)
-  {
-    is_update_queued = true;
-    QTimer::singleShot(10, this, SLOT(update()));
-  }
+  update_scr_queue.insert(update_scr_queue.end(), tiles.begin(), tiles.end());
+  queue_image_updates();
+}
+
+void mapper_widget::queue_image_updates()
+{
+  if (is_update_queued)
+    return;
+  is_update_queued = true;
+  // one present per display frame: right away if the last one is a frame ago, updates coming meanwhile are batched
+  const QScreen *screen = windowHandle() ? windowHandle()->screen() : QGuiApplication::primaryScreen();
+  using ms = std::chrono::duration<double, std::milli>;
+  const ms frame(1000 / std::max(qreal(1), screen->refreshRate()));
+  const ms left = frame - (std::chrono::high_resolution_clock::now() - last_update);
+  QTimer::singleShot(std::max(0, static_cast<int>(std::ceil(left.count()))), this, SLOT(present_image_updates()));
+}
+
+void mapper_widget::present_image_updates()
+{
+  is_update_queued = false;
+  last_update = std::chrono::high_resolution_clock::now();
+  // repaint only the screen rectangles of the queued superpixels
+  for (auto &tile : update_scr_queue)
+    update(QRect(tile.x, tile.y, tile.size << tile.mip_level, tile.size << tile.mip_level).intersected(rect()));
+  flush_image_updates();
 }
 
 void mapper_widget::change_draft_mip_level_event(int new_draft_mip_level)
 {
-  worker.change_draft_mip_level(new_draft_mip_level);
+  worker->change_draft_mip_level(new_draft_mip_level);
+}
+
+void mapper_widget::change_draft_deadline_event(int new_draft_deadline_ms)
+{
+  worker->change_draft_deadline(new_draft_deadline_ms);
+}
+
+void mapper_widget::change_max_iterations_event(int new_max_iterations)
+{
+  escape_time::settings s = worker->get_kernel_settings();
+  s.max_iterations = new_max_iterations;
+  pal = palette(pal.get_period(), new_max_iterations);
+  worker->change_kernel_settings(s);
+}
+
+void mapper_widget::change_smooth_event(bool new_smooth)
+{
+  escape_time::settings s = worker->get_kernel_settings();
+  s.smooth = new_smooth;
+  worker->change_kernel_settings(s);
+}
+
+void mapper_widget::change_palette_period_event(int new_period)
+{
+  // only recolors already rendered iteration values
+  pal = palette(new_period, pal.get_max_iterations());
+  full_image_update();
 }
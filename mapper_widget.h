@@ -1,10 +1,16 @@
 #pragma once
 
+#include <QTimer>
 #include <QWidget>
-#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include "ui_mapper_widget.h"
+#include "blit.h"
 #include "mapper_enterprise.h"
+#include "palette.h"
+#include "perf_stats.h"
 
 class mapper_widget : public QWidget
 {
@@ -18,43 +24,74 @@ public:
   void mouseReleaseEvent(QMouseEvent *event) override;
   void mousePressEvent(QMouseEvent *event) override;
   void wheelEvent(QWheelEvent *event) override;
+  void leaveEvent(QEvent *event) override;
+  void keyPressEvent(QKeyEvent *event) override;
   void paintEvent(QPaintEvent *event) override;
   void resizeEvent(QResizeEvent *event) override;
 
 private slots:
   void full_image_update();
-  void part_image_update(pixel_helper::color *data, int x, int y, int size, int mip_level);
+  void part_image_update(const std::vector<mapper_enterprise::output_tile> &tiles);
   void change_draft_mip_level_event(int new_draft_mip_level);
+  void change_draft_deadline_event(int new_draft_deadline_ms);
+  void change_max_iterations_event(int new_max_iterations);
+  void change_smooth_event(bool new_smooth);
+  void change_palette_period_event(int new_period);
+  void present_image_updates();
+  void stats_overlay_tick();
+  void stats_log_tick();
 
 private:
   QPointF calc_posf(QPoint pos);
+  // shows the current image zoomed around anchor (in pixels) and moved by shift until superpixels come:
+  // fac is new to old pixel scale ratio
+  void show_preview(QPointF anchor, qreal fac, QPoint shift);
+  // schedules present_image_updates at the next display frame
+  void queue_image_updates();
+  // draws queued superpixel updates into cached_result
+  void flush_image_updates();
+  // pal, or the same period for superpixels rendered before a max iterations change
+  const palette &palette_for(int max_iterations);
+  // pre: p paints this widget
+  void draw_stats_overlay(QPainter &p);
+
+  static constexpr int stats_overlay_interval_ms = 1000;
+  static constexpr int stats_log_interval_ms = 5000;
 
   bool left_bt_pressed = false;
   QPoint last_mouse_pos;
 
-  mapper_enterprise worker;
+  /* Superpixel size of MANDELBROT_TILE_SIZE: 64 to 512 pixels, or auto for the fastest measured
+   * for the available screen size and the cores, kept in the settings for them; 256 by default,
+   * and for auto until it is measured. The window is not shown yet and can be resized any time,
+   * so the available screen size stands for it: the largest the window gets, where the superpixel size matters most */
+  static int startup_superpixel_size_pow();
+  // with auto and no size kept for the screen and the cores, measures it on tile_size_tuner for the next start
+  void tune_superpixel_size();
+  std::thread tile_size_tuner;
+  std::unique_ptr<mapper_enterprise> worker = mapper_enterprise::create(startup_superpixel_size_pow());
+  palette pal;
+  palette stale_pal;  // of palette_for
   std::vector<pixel_helper::color> cached_result;
+  QImage cached_image;  // shares cached_result's buffer, rebuilt on resize
+  std::vector<pixel_helper::color> preview_source;  // previous cached_result while resampling it
 
   bool is_update_queued = false, is_full_update_queued = false;
-  std::chrono::high_resolution_clock::time_point last_update;
-
-  struct update_scr_query
-  {
-    int scr_x, scr_y, mip_w, mip_h, mip_level;
-    std::vector<pixel_helper::color> data;
-
-    update_scr_query(int scr_x = -1, int scr_y = -1, int mip_w = 0, int mip_h = 0, int mip_level = 0) : scr_x(scr_x), scr_y(scr_y), mip_level(mip_level)
-    {
-      resize(mip_w, mip_h);
-    }
-
-    void resize(int new_w, int new_h)
-    {
-      mip_w = new_w, mip_h = new_h;
-      data.resize(new_w * new_h);
-    }
-  };
-  std::deque<update_scr_query> update_scr_queue;
+  std::chrono::high_resolution_clock::time_point last_update;  // of present_image_updates
+
+  // superpixel levels to draw, sharing the worker's buffers; a later one at the same place supersedes older ones
+  std::vector<mapper_enterprise::output_tile> update_scr_queue;
+  std::vector<pixel_helper::color> update_colors;  // colorized queued levels, reused by flushes
+  blit_workers blit_pool{std::max(1u, std::thread::hardware_concurrency())};  // idle between flushes
+
+  /* Performance counters: overlay toggled by F3, rates of its last interval;
+   * appended to the file named by MANDELBROT_STATS_LOG ("-" for stderr) every stats_log_interval_ms */
+  bool is_stats_overlay_shown = false;
+  QTimer stats_overlay_timer;
+  perf_stats::snapshot stats_overlay_prev, stats_overlay_cur;
+  QString stats_log_path;
+  QTimer stats_log_timer;
+  perf_stats::snapshot stats_log_prev;
 
   Ui::mapper_widget ui;
 };
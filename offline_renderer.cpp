@@ -0,0 +1,226 @@
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "offline_renderer.h"
+#include "superpixel.h"
+#include "task_queue.h"
+
+template<int SizePow>
+class offline_renderer::sized_engine final : public offline_renderer::engine
+{
+public:
+  static constexpr size_t superpixel_size = size_t(1) << SizePow;
+
+  explicit sized_engine(unsigned n_workers);
+  ~sized_engine() override;
+
+  bool render(const view &v, const view_kernel &kernel, const std::function<bool(const float *, int)> &row) override;
+  void render_tiles(const view &v, const view_kernel &kernel, const std::vector<QPoint> &corners, int mip_level,
+                    const std::function<void(size_t, const float *)> &on_tile) override;
+
+private:
+  struct band;
+
+  // type for task queue
+  struct tile_base : ::superpixel<view_kernel, superpixel_size, float>
+  {
+    size_t priority()
+    {
+      return 0;
+    }
+
+    band *owner = nullptr;  // nullptr quits the worker
+    size_t index = 0;       // in the band
+  };
+  using task_queue_t = work_stealing_queue<tile_base, 0>;
+  using tile = typename task_queue_t::store_type;
+
+  /* Row of superpixels */
+  struct band
+  {
+    std::unique_ptr<tile[]> tiles;
+    std::mutex m;
+    std::condition_variable cv;
+    size_t remaining = 0;  // tiles being rendered
+    const std::function<void(size_t, const float *)> *on_tile = nullptr;  // called by the workers
+  };
+
+  // pushes superpixels of the band with upper rows at y
+  void start_band(band &b, const view &v, const view_kernel &kernel, int y);
+  // pushes tile b.tiles[index] with upper left pixel (x, y)
+  void start_tile(band &b, size_t index, const view &v, const view_kernel &kernel, int x, int y, int mip_level);
+  void wait_band(band &b);
+
+  const unsigned n_workers;
+  task_queue_t task_queue{n_workers};
+  std::vector<std::thread> workers;
+};
+
+template<int SizePow>
+offline_renderer::sized_engine<SizePow>::sized_engine(unsigned n_workers) : n_workers(n_workers)
+{
+  for (unsigned i = 0; i < n_workers; i++)
+    workers.emplace_back(std::thread([this, i] {
+      for (;;)
+      {
+        tile &t = task_queue.pop(i);
+        if (t.owner == nullptr)
+          break;
+        auto job = t.next_job();
+        t.publish(job, job.render([] { return false; }));
+        if (t.owner->on_tile != nullptr)
+          (*t.owner->on_tile)(t.index, t.get_mip_data());
+
+        std::lock_guard lg(t.owner->m);
+        if (--t.owner->remaining == 0)
+          t.owner->cv.notify_one();
+      }
+    }));
+}
+
+template<int SizePow>
+offline_renderer::sized_engine<SizePow>::~sized_engine()
+{
+  std::vector<tile> quit(n_workers);
+  for (tile &t : quit)
+    task_queue.push(t);
+  for (auto &th : workers)
+    th.join();
+}
+
+template<int SizePow>
+void offline_renderer::sized_engine<SizePow>::start_band(band &b, const view &v, const view_kernel &kernel, int y)
+{
+  const size_t cols = (v.width + superpixel_size - 1) / superpixel_size;
+  {
+    std::lock_guard lg(b.m);
+    b.remaining = cols;
+  }
+  for (size_t c = 0; c < cols; c++)
+    start_tile(b, c, v, kernel, static_cast<int>(c * superpixel_size), y, 0);
+}
+
+template<int SizePow>
+void offline_renderer::sized_engine<SizePow>::start_tile(band &b, size_t index, const view &v,
+                                                         const view_kernel &kernel, int x, int y, int mip_level)
+{
+  tile &t = b.tiles[index];
+  t.ul_corner = QPointF(x - v.width / 2., y - v.height / 2.) * v.pixel_scale;
+  t.scale = superpixel_size * v.pixel_scale;
+  t.grid = tile::sample_grid::CENTERED;
+  t.mode = tile::render_mode::SUBDIVIDE;
+  t.set_func(kernel);
+  t.set_mip_level(mip_level);
+  t.owner = &b;
+  t.index = index;
+  task_queue.push(t);
+}
+
+template<int SizePow>
+void offline_renderer::sized_engine<SizePow>::wait_band(band &b)
+{
+  std::unique_lock lg(b.m);
+  b.cv.wait(lg, [&b] { return b.remaining == 0; });
+}
+
+template<int SizePow>
+bool offline_renderer::sized_engine<SizePow>::render(const view &v, const view_kernel &kernel,
+                                                     const std::function<bool(const float *, int)> &row)
+{
+  const size_t cols = (v.width + superpixel_size - 1) / superpixel_size;
+  const int n_bands = static_cast<int>((v.height + superpixel_size - 1) / superpixel_size);
+  band bands[2];
+  for (band &b : bands)
+    b.tiles = std::make_unique<tile[]>(cols);
+
+  std::vector<float> line(v.width);
+  bool res = true;
+  if (n_bands > 0)
+    start_band(bands[0], v, kernel, 0);
+  for (int k = 0; k < n_bands && res; k++)
+  {
+    band &cur = bands[k % 2];
+    if (k + 1 < n_bands)
+      start_band(bands[(k + 1) % 2], v, kernel, (k + 1) * superpixel_size);
+    wait_band(cur);
+
+    const int y0 = k * superpixel_size, rows = std::min<int>(superpixel_size, v.height - y0);
+    for (int r = 0; r < rows && res; r++)
+    {
+      for (size_t c = 0; c < cols; c++)
+      {
+        const float *src = cur.tiles[c].get_mip_data() + r * superpixel_size;
+        const size_t x0 = c * superpixel_size, n = std::min<size_t>(superpixel_size, v.width - x0);
+        std::copy(src, src + n, line.begin() + x0);
+      }
+      res = row(line.data(), y0 + r);
+    }
+    for (size_t c = 0; c < cols; c++)
+      cur.tiles[c].clear();
+  }
+
+  // the band started ahead is still referenced by the workers when stopped early
+  for (band &b : bands)
+    wait_band(b);
+  return res;
+}
+
+template<int SizePow>
+void offline_renderer::sized_engine<SizePow>::render_tiles(const view &v, const view_kernel &kernel,
+                                                           const std::vector<QPoint> &corners, int mip_level,
+                                                           const std::function<void(size_t, const float *)> &on_tile)
+{
+  band b;
+  b.tiles = std::make_unique<tile[]>(corners.size());
+  b.remaining = corners.size();
+  b.on_tile = &on_tile;
+  for (size_t i = 0; i < corners.size(); i++)
+    start_tile(b, i, v, kernel, corners[i].x(), corners[i].y(), mip_level);
+  wait_band(b);
+}
+
+offline_renderer::offline_renderer(unsigned n_workers, int tile_size_pow) : n_workers(n_workers)
+{
+  set_tile_size_pow(tile_size_pow);
+}
+
+offline_renderer::~offline_renderer() = default;
+
+void offline_renderer::set_tile_size_pow(int tile_size_pow)
+{
+  if (impl != nullptr && tile_size_pow == this->tile_size_pow)
+    return;
+  impl.reset();  // joins the old workers first
+  this->tile_size_pow = tile_size_pow;
+  impl = tile_size::dispatch(tile_size_pow, [this](auto size_pow) -> std::unique_ptr<engine> {
+    return std::make_unique<sized_engine<decltype(size_pow)::value>>(n_workers);
+  });
+}
+
+bool offline_renderer::render(const view &v, const std::function<bool(const float *, int)> &row)
+{
+  return impl->render(v, kernel_of(v), row);
+}
+
+void offline_renderer::render_tiles(const view &v, const std::vector<QPoint> &corners, int mip_level,
+                                    const std::function<void(size_t, const float *)> &tile)
+{
+  impl->render_tiles(v, kernel_of(v), corners, mip_level, tile);
+}
+
+view_kernel offline_renderer::kernel_of(const view &v)
+{
+  std::lock_guard lg(kernel_m);
+  const view &k = kernel_view;
+  if (!has_kernel || k.center_x.hi != v.center_x.hi || k.center_x.lo != v.center_x.lo ||
+      k.center_y.hi != v.center_y.hi || k.center_y.lo != v.center_y.lo || k.pixel_scale != v.pixel_scale ||
+      !(k.settings == v.settings) || k.tier != v.tier)
+  {
+    kernel = v.tier ? view_kernel::create(*v.tier, v.center_x, v.center_y, v.settings)
+                    : view_kernel::create(get_tiers(), v.center_x, v.center_y, v.pixel_scale, v.settings);
+    kernel_view = v;
+    has_kernel = true;
+  }
+  return kernel;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#include <QPoint>
+
+#include "double_double.h"
+#include "escape_time.h"
+#include "kernel_tiers.h"
+#include "tile_size.h"
+#include "view_kernel.h"
+
+/* Renders images of any size without a window: the image is split into bands one superpixel high,
+ * superpixels of the next band are rendered by the workers while the rows of the current one are handed out,
+ * so at most two bands are kept in memory, whatever the image height is.
+ * Larger superpixels have less overhead per pixel, smaller ones balance narrow images over more workers */
+class offline_renderer
+{
+public:
+  struct view
+  {
+    dd_real center_x, center_y;
+    qreal pixel_scale = 0.01;  // distance between pixels
+    int width = 0, height = 0;
+    escape_time::settings settings;
+    std::optional<kernel_tier> tier;  // picked by the renderer's tiers for pixel_scale if none
+  };
+
+  // superpixels of 1 << tile_size_pow pixels, pre: tile_size::is_valid(tile_size_pow)
+  explicit offline_renderer(unsigned n_workers = std::max(1u, std::thread::hardware_concurrency()),
+                            int tile_size_pow = tile_size::default_pow);
+  offline_renderer(const offline_renderer &) = delete;
+  offline_renderer &operator=(const offline_renderer &) = delete;
+  ~offline_renderer();
+
+  /* Hands out iteration values (see escape_time) of the rows top to bottom by row(const float *values, int y),
+   * on the calling thread. Stops when row returns false, returns whether all rows were handed out */
+  bool render(const view &v, const std::function<bool(const float *, int)> &row);
+
+  /* Renders the superpixels of v with upper left pixels at corners (image pixels) at mip_level:
+   * tile(i, values) gets the iteration values of corners[i], (size >> mip_level)^2 of them row by row,
+   * on the worker that rendered it. Returns when all are handed out. Calls from several threads share the workers,
+   * not with set_tile_size_pow */
+  void render_tiles(const view &v, const std::vector<QPoint> &corners, int mip_level,
+                    const std::function<void(size_t, const float *)> &tile);
+
+  // restarts the workers with superpixels of the new size, pre: tile_size::is_valid(tile_size_pow)
+  void set_tile_size_pow(int tile_size_pow);
+
+  int get_tile_size_pow() const
+  {
+    return tile_size_pow;
+  }
+  unsigned get_n_workers() const
+  {
+    return n_workers;
+  }
+  // calibrated on the first call, farm workers get the tier with the view and never do
+  const kernel_tiers &get_tiers() const
+  {
+    return kernel_tiers::calibrated();
+  }
+
+private:
+  /* Workers and bands of one superpixel size */
+  struct engine
+  {
+    virtual ~engine() = default;
+    virtual bool render(const view &v, const view_kernel &kernel,
+                        const std::function<bool(const float *, int)> &row) = 0;
+    virtual void render_tiles(const view &v, const view_kernel &kernel, const std::vector<QPoint> &corners,
+                              int mip_level, const std::function<void(size_t, const float *)> &tile) = 0;
+  };
+  template<int SizePow>
+  class sized_engine;
+
+  // kernel of the view, the last one is kept for the tiles of the same view
+  view_kernel kernel_of(const view &v);
+
+  const unsigned n_workers;
+  int tile_size_pow = 0;
+  std::unique_ptr<engine> impl;
+
+  std::mutex kernel_m;
+  bool has_kernel = false;
+  view kernel_view;
+  view_kernel kernel;
+};
@@ -0,0 +1,36 @@
+#include <cmath>
+
+#include "palette.h"
+
+static pixel_helper::color float2color(qreal X)
+{
+  using color = pixel_helper::color;
+  qreal c = X;
+  c = c * (2 - c);
+  c = fmod(c * 7 * 3, 7);
+
+  switch (static_cast<int>(c))
+  {
+  case 0:
+    return color(c, 0, 0);
+  case 1:
+    return color(1, c - 1, 0);
+  case 2:
+    return color(3 - c, 1, 0);
+  case 3:
+    return color(0, 1, c - 3);
+  case 4:
+    return color(0, 5 - c, 1);
+  case 5:
+    return color(c - 5, 0, 1);
+  default:
+    return color(1, c - 6, 1);
+  }
+}
+
+palette::palette(qreal period, int max_iterations)
+    : period(period), max_iterations(max_iterations), scale(static_cast<float>(lut_size / period)), lut(lut_size)
+{
+  for (size_t i = 0; i < lut_size; i++)
+    lut[i] = float2color(i * 1.0 / lut_size);
+}
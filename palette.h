@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include "escape_time.h"
+#include "superpixel.h"
+
+/* Precomputed lookup table from iteration values to colors:
+ * the palette repeats every `period` iterations, the set interior is black */
+class palette
+{
+public:
+  static constexpr qreal default_period = 255;
+
+  explicit palette(qreal period = default_period, int max_iterations = escape_time::default_max_iterations);
+
+  pixel_helper::color operator()(float value) const
+  {
+    if (value >= max_iterations)
+      return pixel_helper::color(uchar(0), uchar(0), uchar(0));
+    return lut[static_cast<size_t>(value * scale) & (lut_size - 1)];
+  }
+
+  void colorize(pixel_helper::color *dst, const float *src, size_t count) const
+  {
+    for (size_t i = 0; i < count; i++)
+      dst[i] = (*this)(src[i]);
+  }
+
+  qreal get_period() const
+  {
+    return period;
+  }
+  int get_max_iterations() const
+  {
+    return max_iterations;
+  }
+
+private:
+  static constexpr size_t lut_size = 4096;  // power of 2
+
+  qreal period;
+  int max_iterations;
+  float scale;  // LUT entries per iteration
+  std::vector<pixel_helper::color> lut;
+};
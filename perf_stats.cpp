@@ -0,0 +1,200 @@
+#include <cinttypes>
+#include <cstdio>
+#include <QFile>
+
+#include "perf_stats.h"
+
+namespace
+{
+  constexpr const char *counter_names[size_t(perf_stats::counter::COUNT)] = {
+      "queued", "rendered", "cancelled", "stale", "requeued", "reused", "missed deadlines", "frames",
+      "kernel pixels", "cardioid bulb pixels", "periodic pixels",
+  };
+  // counters before it are shown as rates on two lines, the kernel ones as shares of its pixels
+  constexpr size_t first_kernel_counter = size_t(perf_stats::counter::KERNEL_PIXELS);
+
+  constexpr const char *gauge_names[size_t(perf_stats::gauge::COUNT)] = {
+      "pool superpixels", "screen superpixels", "superpixel bytes", "pyramid bytes", "arena bytes",
+  };
+
+  constexpr const char *histogram_names[size_t(perf_stats::histogram::COUNT)] = {
+      "frame time", "first pixel", "render", "zoom",
+  };
+
+  struct window
+  {
+    uint64_t count = 0;
+    double avg_ms = 0;
+    double p50_ms = 0, p99_ms = 0;  // upper bounds of their buckets
+  };
+
+  // percentiles of the recordings of h between prev and cur
+  window histogram_window(const perf_stats::snapshot &cur, const perf_stats::snapshot &prev, size_t h)
+  {
+    window res;
+    uint64_t buckets[perf_stats::histogram_buckets];
+    for (size_t i = 0; i < perf_stats::histogram_buckets; i++)
+    {
+      buckets[i] = cur.histograms[h][i] - prev.histograms[h][i];
+      res.count += buckets[i];
+    }
+    if (res.count == 0)
+      return res;
+    res.avg_ms = (cur.histogram_sums_us[h] - prev.histogram_sums_us[h]) / 1e3 / res.count;
+
+    auto percentile = [&](double p) {
+      uint64_t rank = static_cast<uint64_t>(p * (res.count - 1)), seen = 0;
+      for (size_t i = 0; i < perf_stats::histogram_buckets; i++)
+      {
+        seen += buckets[i];
+        if (seen > rank)
+          return (uint64_t(1) << (i + 1)) / 1e3;
+      }
+      return (uint64_t(1) << perf_stats::histogram_buckets) / 1e3;
+    };
+    res.p50_ms = percentile(0.5);
+    res.p99_ms = percentile(0.99);
+    return res;
+  }
+
+  double seconds_between(const perf_stats::snapshot &cur, const perf_stats::snapshot &prev)
+  {
+    return std::chrono::duration<double>(cur.time - prev.time).count();
+  }
+
+  QString format_bytes(int64_t bytes)
+  {
+    return QString::number(bytes / double(1 << 20), 'f', 1) + " MB";
+  }
+}  // namespace
+
+void perf_stats::set_queue_depth(size_t prior, int64_t depth)
+{
+  queue_depths[prior].store(depth, std::memory_order_relaxed);
+  size_t n = queue_priorities.load(std::memory_order_relaxed);
+  while (n < prior + 1 && !queue_priorities.compare_exchange_weak(n, prior + 1, std::memory_order_relaxed))
+    ;
+}
+
+void perf_stats::record(histogram h, std::chrono::nanoseconds duration)
+{
+  const uint64_t us = duration.count() > 0 ? static_cast<uint64_t>(duration.count()) / 1000 : 0;
+  size_t bucket = 0;
+  while (bucket + 1 < histogram_buckets && (us >> (bucket + 1)) != 0)
+    bucket++;
+  histograms[size_t(h)][bucket].fetch_add(1, std::memory_order_relaxed);
+  histogram_sums_us[size_t(h)].fetch_add(us, std::memory_order_relaxed);
+}
+
+perf_stats::snapshot perf_stats::take()
+{
+  snapshot res;
+  res.time = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < size_t(counter::COUNT); i++)
+    res.counters[i] = counters[i].load(std::memory_order_relaxed);
+  for (size_t i = 0; i < size_t(gauge::COUNT); i++)
+    res.gauges[i] = gauges[i].load(std::memory_order_relaxed);
+  res.queue_depths.resize(queue_priorities.load(std::memory_order_relaxed));
+  for (size_t i = 0; i < res.queue_depths.size(); i++)
+    res.queue_depths[i] = queue_depths[i].load(std::memory_order_relaxed);
+  for (size_t h = 0; h < size_t(histogram::COUNT); h++)
+  {
+    for (size_t i = 0; i < histogram_buckets; i++)
+      res.histograms[h][i] = histograms[h][i].load(std::memory_order_relaxed);
+    res.histogram_sums_us[h] = histogram_sums_us[h].load(std::memory_order_relaxed);
+  }
+  return res;
+}
+
+std::vector<QString> perf_stats::format(const snapshot &cur, const snapshot &prev)
+{
+  std::vector<QString> res;
+  const double seconds = seconds_between(cur, prev);
+
+  QString line;
+  for (size_t i = 0; i < first_kernel_counter; i++)
+  {
+    double rate = seconds > 0 ? (cur.counters[i] - prev.counters[i]) / seconds : 0;
+    line += QString(counter_names[i]) + " " + QString::number(rate, 'f', 1) + "/s";
+    // two lines of counters
+    if (i + 1 == first_kernel_counter / 2 || i + 1 == first_kernel_counter)
+    {
+      res.push_back(line);
+      line.clear();
+    }
+    else
+      line += "  ";
+  }
+
+  auto delta = [&](counter c) { return cur.counters[size_t(c)] - prev.counters[size_t(c)]; };
+  const uint64_t pixels = delta(counter::KERNEL_PIXELS);
+  auto share = [pixels](uint64_t n) { return QString::number(pixels > 0 ? 100. * n / pixels : 0, 'f', 1) + "%"; };
+  res.push_back("kernel pixels " + QString::number(seconds > 0 ? pixels / seconds / 1e6 : 0, 'f', 2) +
+                "M/s  interior shortcuts: cardioid/bulb " + share(delta(counter::CARDIOID_BULB_PIXELS)) +
+                "  periodic " + share(delta(counter::PERIODIC_PIXELS)));
+
+  for (size_t h = 0; h < size_t(histogram::COUNT); h++)
+  {
+    window w = histogram_window(cur, prev, h);
+    res.push_back(QString(histogram_names[h]) + ": n " + QString::number(w.count) + "  avg " +
+                  QString::number(w.avg_ms, 'f', 2) + " ms  p50 <" + QString::number(w.p50_ms, 'f', 2) +
+                  " ms  p99 <" + QString::number(w.p99_ms, 'f', 2) + " ms");
+  }
+
+  // highest priority (coarsest mip level) first, as the workers take them
+  line = "queue depth by priority:";
+  for (size_t i = cur.queue_depths.size(); i > 0; i--)
+    line += " " + QString::number(cur.queue_depths[i - 1]);
+  res.push_back(line);
+
+  res.push_back("superpixels: pool " + QString::number(cur.gauges[size_t(gauge::POOL_SUPERPIXELS)]) + "  screen " +
+                QString::number(cur.gauges[size_t(gauge::SCREEN_SUPERPIXELS)]));
+  res.push_back("memory: superpixels " + format_bytes(cur.gauges[size_t(gauge::SUPERPIXEL_BYTES)]) + "  pyramid " +
+                format_bytes(cur.gauges[size_t(gauge::PYRAMID_BYTES)]) + "  arena " +
+                format_bytes(cur.gauges[size_t(gauge::ARENA_BYTES)]));
+  return res;
+}
+
+std::string perf_stats::to_json(const snapshot &cur, const snapshot &prev)
+{
+  const double seconds = seconds_between(cur, prev);
+  char buf[256];
+  int n = std::snprintf(buf, sizeof(buf), "{\"seconds\":%.3f", seconds);
+  std::string out(buf, n);
+
+  for (size_t i = 0; i < size_t(counter::COUNT); i++)
+  {
+    n = std::snprintf(buf, sizeof(buf), ",\"%s\":%" PRIu64, counter_names[i], cur.counters[i] - prev.counters[i]);
+    out.append(buf, n);
+  }
+  for (size_t i = 0; i < size_t(gauge::COUNT); i++)
+  {
+    n = std::snprintf(buf, sizeof(buf), ",\"%s\":%" PRId64, gauge_names[i], cur.gauges[i]);
+    out.append(buf, n);
+  }
+  out += ",\"queue depths\":[";
+  for (size_t i = 0; i < cur.queue_depths.size(); i++)
+    out += (i == 0 ? "" : ",") + std::to_string(cur.queue_depths[i]);
+  out += "]";
+  for (size_t h = 0; h < size_t(histogram::COUNT); h++)
+  {
+    window w = histogram_window(cur, prev, h);
+    n = std::snprintf(buf, sizeof(buf), ",\"%s\":{\"n\":%" PRIu64 ",\"avg_ms\":%.3f,\"p50_ms\":%.3f,\"p99_ms\":%.3f}",
+                      histogram_names[h], w.count, w.avg_ms, w.p50_ms, w.p99_ms);
+    out.append(buf, n);
+  }
+  out += "}\n";
+  return out;
+}
+
+bool perf_stats::dump(const QString &path, const snapshot &cur, const snapshot &prev)
+{
+  const std::string line = to_json(cur, prev);
+  if (path == "-")
+    return std::fwrite(line.data(), 1, line.size(), stderr) == line.size();
+
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+    return false;
+  return file.write(line.data(), line.size()) == qint64(line.size());
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <QString>
+
+/* Live performance counters: a fixed registry of counters, gauges and latency histograms updated
+ * with relaxed atomics from any thread, without locks or registration.
+ * Readers take a snapshot; the difference of two snapshots describes the window between them
+ * (rates and latency percentiles of the last seconds rather than of the whole session) */
+namespace perf_stats
+{
+  // monotonic totals
+  enum class counter : uint8_t
+  {
+    SUPERPIXELS_QUEUED,     // render tasks pushed
+    SUPERPIXELS_RENDERED,   // mip levels published
+    SUPERPIXELS_CANCELLED,  // renders dropped for input version change
+    STALE_TASKS,            // tasks popped after their superpixel was freed or pushed again
+    TASKS_REQUEUED,         // tasks pushed again for their viewport class change
+    SUPERPIXELS_REUSED,     // new screen superpixels filled from the pyramid or the disk cache
+    MISSED_DEADLINES,       // input changes whose drafts missed the draft deadline
+    FRAMES,                 // paints
+    KERNEL_PIXELS,          // computed by the escape-time row kernels
+    CARDIOID_BULB_PIXELS,   // of them resolved by the main cardioid and period-2 bulb test
+    PERIODIC_PIXELS,        // ... by orbit periodicity detection
+    COUNT
+  };
+
+  // current values
+  enum class gauge : uint8_t
+  {
+    POOL_SUPERPIXELS,    // allocated superpixels, free or on the screen
+    SCREEN_SUPERPIXELS,  // on the (cached) screen
+    SUPERPIXEL_BYTES,
+    PYRAMID_BYTES,
+    ARENA_BYTES,
+    COUNT
+  };
+
+  // durations in power of 2 microsecond buckets
+  enum class histogram : uint8_t
+  {
+    FRAME_TIME,           // paint
+    FIRST_PIXEL_LATENCY,  // input change to the first superpixel it added drawn
+    RENDER_TIME,          // one mip level of a superpixel
+    ZOOM_TIME,            // mapper_enterprise::zoom on the GUI thread
+    COUNT
+  };
+
+  constexpr size_t max_queue_priorities = 16;
+  constexpr size_t histogram_buckets = 32;  // bucket i: [2^i, 2^(i+1)) us, bucket 0 from 0
+
+  inline std::atomic<uint64_t> counters[size_t(counter::COUNT)]{};
+  inline std::atomic<int64_t> gauges[size_t(gauge::COUNT)]{};
+  inline std::atomic<int64_t> queue_depths[max_queue_priorities]{};  // queued tasks by priority, including stale ones
+  inline std::atomic<size_t> queue_priorities = 0;                   // highest priority set + 1
+  inline std::atomic<uint64_t> histograms[size_t(histogram::COUNT)][histogram_buckets]{};
+  inline std::atomic<uint64_t> histogram_sums_us[size_t(histogram::COUNT)]{};
+
+  inline void add(counter c, uint64_t n = 1)
+  {
+    counters[size_t(c)].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  inline void set(gauge g, int64_t value)
+  {
+    gauges[size_t(g)].store(value, std::memory_order_relaxed);
+  }
+
+  // pre: prior < max_queue_priorities
+  void set_queue_depth(size_t prior, int64_t depth);
+
+  void record(histogram h, std::chrono::nanoseconds duration);
+
+  /* Time since construction recorded to h on destruction */
+  class timer
+  {
+  public:
+    explicit timer(histogram h) : h(h), start(std::chrono::steady_clock::now()) {}
+    ~timer()
+    {
+      record(h, std::chrono::steady_clock::now() - start);
+    }
+
+  private:
+    histogram h;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  struct snapshot
+  {
+    std::chrono::steady_clock::time_point time;
+    uint64_t counters[size_t(counter::COUNT)]{};
+    int64_t gauges[size_t(gauge::COUNT)]{};
+    std::vector<int64_t> queue_depths;
+    uint64_t histograms[size_t(histogram::COUNT)][histogram_buckets]{};
+    uint64_t histogram_sums_us[size_t(histogram::COUNT)]{};
+  };
+
+  snapshot take();
+
+  // lines of counter rates and latency percentiles between prev and cur, and of the gauges of cur
+  std::vector<QString> format(const snapshot &cur, const snapshot &prev);
+  // the same as one line of JSON
+  std::string to_json(const snapshot &cur, const snapshot &prev);
+
+  // appends to_json to the file at path ("-" for stderr), returns false on I/O error
+  bool dump(const QString &path, const snapshot &cur, const snapshot &prev);
+}  // namespace perf_stats
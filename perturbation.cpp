@@ -0,0 +1,68 @@
+#include "perturbation.h"
+
+reference_orbit::reference_orbit(dd_real c_x, dd_real c_y, const escape_time::settings &s) : s(s)
+{
+  orbit.reserve(s.max_iterations + 2);
+  dd_real z_x = 0, z_y = 0;
+  orbit.push_back(0);
+  for (int n = 0; n <= s.max_iterations; n++)
+  {
+    dd_real z_xx = z_x * z_x, z_yy = z_y * z_y, z_xy = z_x * z_y;
+    z_x = z_xx - z_yy + c_x;
+    z_y = z_xy + z_xy + c_y;
+    std::complex<double> z(static_cast<double>(z_x), static_cast<double>(z_y));
+    orbit.push_back(z);
+    if (std::norm(z) >= 4)
+      break;
+  }
+}
+
+// No cardioid/bulb test here: C + dc is not representable in double at perturbation depths
+float reference_orbit::calc(std::complex<double> dc, qreal tolerance, escape_time::shortcut_counts &counts) const
+{
+  const size_t last = orbit.size() - 1;
+  const qreal tolerance2 = tolerance * tolerance;
+  std::complex<double> dz = 0, check = orbit[1] + dc;
+  size_t m = 0;
+  int check_period = 1, check_steps = 0;
+
+  for (int n = 0; n < s.max_iterations; n++)
+  {
+    dz = (2.0 * orbit[m] + dz) * dz + dc;
+    m++;
+    std::complex<double> z = orbit[m] + dz;
+    if (!(std::norm(z) < 4))
+      return escape_time::escaped_value(n, std::norm(z), s);
+    if (n > 0 && std::norm(z - check) < tolerance2)
+    {
+      counts.periodic++;
+      return static_cast<float>(s.max_iterations);
+    }
+    if (n > 0 && ++check_steps == check_period)
+    {
+      check = z;
+      check_steps = 0;
+      check_period *= 2;
+    }
+    // glitch: the full value is smaller than the delta (or the reference has escaped),
+    // continue from the start of the reference orbit where Z_0 = 0 and dz = z is exact
+    if (std::norm(z) < std::norm(dz) || m == last)
+    {
+      dz = z;
+      m = 0;
+    }
+  }
+  return static_cast<float>(s.max_iterations);
+}
+
+void reference_orbit::calc_row(float *out, QPointF start, QPointF step, size_t count) const
+{
+  const qreal tolerance = escape_time::periodicity_tolerance(step);
+  escape_time::shortcut_counts counts;
+  for (size_t i = 0; i < count; i++)
+  {
+    QPointF dc = start + step * qreal(i);
+    out[i] = calc({dc.x(), dc.y()}, tolerance, counts);
+  }
+  counts.flush(count);
+}
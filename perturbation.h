@@ -0,0 +1,29 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+#include <QPointF>
+
+#include "double_double.h"
+#include "escape_time.h"
+
+/* Reference orbit for perturbation rendering:
+ * the orbit of one point C is computed in double-double precision once per view,
+ * then every pixel C + dc iterates only its double-precision delta dz against it:
+ *   dz' = (2 * Z + dz) * dz + dc
+ * Glitches (loss of precision where Z + dz gets smaller than dz) are detected
+ * and fixed by rebasing the pixel onto the start of the reference orbit. */
+class reference_orbit
+{
+public:
+  reference_orbit(dd_real c_x, dd_real c_y, const escape_time::settings &s);
+
+  // Fills out[i] with the iteration value of C + start + i * step for i in [0, count)
+  void calc_row(float *out, QPointF start, QPointF step, size_t count) const;
+
+private:
+  float calc(std::complex<double> dc, qreal tolerance, escape_time::shortcut_counts &counts) const;
+
+  std::vector<std::complex<double>> orbit;  // Z_0 = 0, Z_{m+1} = Z_m^2 + C, until Z escapes
+  escape_time::settings s;
+};
@@ -0,0 +1,742 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <QEventLoop>
+#include <QHostAddress>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include "render_farm.h"
+
+namespace
+{
+  using clock = std::chrono::steady_clock;
+
+  constexpr uint32_t message_magic = 0x4d46524d;  // "MRFM"
+  constexpr uint32_t protocol_version = 2;  // 2: kernel tier in jobs
+  constexpr uint32_t max_payload_bytes = 64u << 20;
+  constexpr int connect_timeout_ms = 10000;
+
+  enum class message_type : uint32_t
+  {
+    HELLO,   // worker: hello_message
+    JOB,     // coordinator: job_message, the tiles after it are of that job
+    TILE,    // coordinator: tile_message
+    RESULT,  // worker: result_message, then the compressed values
+  };
+
+  struct message_header
+  {
+    uint32_t magic = message_magic;
+    message_type type = message_type::HELLO;
+    uint32_t payload_bytes = 0;
+    uint32_t reserved = 0;
+  };
+
+  struct hello_message
+  {
+    uint32_t version = protocol_version;
+    uint32_t n_threads = 0;
+  };
+
+  struct job_message
+  {
+    uint32_t job_id = 0;
+    int32_t tile_size_pow = 0;
+    double center_x_hi = 0, center_x_lo = 0, center_y_hi = 0, center_y_lo = 0;
+    double pixel_scale = 0;
+    int32_t width = 0, height = 0;
+    int32_t max_iterations = 0;
+    uint32_t smooth = 0;
+    uint32_t tier = 0;  // kernel_tier
+    uint32_t reserved = 0;
+  };
+
+  struct tile_message
+  {
+    uint32_t job_id = 0;
+    uint32_t tile_id = 0;
+    int32_t x = 0, y = 0;  // upper left pixel
+    int32_t mip_level = 0;
+    uint32_t reserved = 0;
+  };
+
+  struct result_message
+  {
+    uint32_t job_id = 0;
+    uint32_t tile_id = 0;
+    uint32_t n_values = 0;
+    uint32_t reserved = 0;
+  };
+
+  static_assert(sizeof(message_header) == 16 && sizeof(hello_message) == 8 && sizeof(job_message) == 72 &&
+                sizeof(tile_message) == 24 && sizeof(result_message) == 16);
+
+  template<class Message>
+  QByteArray message(message_type type, const Message &msg, const QByteArray &values = QByteArray())
+  {
+    message_header h;
+    h.type = type;
+    h.payload_bytes = static_cast<uint32_t>(sizeof(msg) + values.size());
+    QByteArray res;
+    res.reserve(static_cast<int>(sizeof(h) + h.payload_bytes));
+    res.append(reinterpret_cast<const char *>(&h), sizeof(h));
+    res.append(reinterpret_cast<const char *>(&msg), sizeof(msg));
+    res.append(values);
+    return res;
+  }
+
+  template<class Message>
+  bool read_message(const char *payload, size_t bytes, Message &msg)
+  {
+    if (bytes < sizeof(msg))
+      return false;
+    std::memcpy(&msg, payload, sizeof(msg));
+    return true;
+  }
+
+  /* Takes the complete messages from the front of buf by func(message_type, const char *payload, size_t bytes),
+   * which returns false for a bad one. Returns false on a bad message */
+  template<class Func>
+  bool take_messages(QByteArray &buf, Func &&func)
+  {
+    size_t offset = 0;
+    bool ok = true;
+    while (ok && size_t(buf.size()) - offset >= sizeof(message_header))
+    {
+      message_header h;
+      std::memcpy(&h, buf.constData() + offset, sizeof(h));
+      ok = h.magic == message_magic && h.payload_bytes <= max_payload_bytes;
+      if (!ok || size_t(buf.size()) - offset - sizeof(h) < h.payload_bytes)
+        break;
+      ok = func(h.type, buf.constData() + offset + sizeof(h), size_t(h.payload_bytes));
+      offset += sizeof(h) + h.payload_bytes;
+    }
+    buf.remove(0, static_cast<int>(offset));
+    return ok;
+  }
+
+  /* Iteration values are compressed with their bytes apart: the first bytes of all values, then the second ones...
+   * Exponents and high mantissa bytes of neighbouring pixels repeat, low mantissa bytes of smooth values don't */
+  QByteArray pack_values(const float *values, size_t n)
+  {
+    QByteArray planes(static_cast<int>(n * sizeof(float)), Qt::Uninitialized);
+    const auto *src = reinterpret_cast<const uchar *>(values);
+    auto *dst = reinterpret_cast<uchar *>(planes.data());
+    for (size_t b = 0; b < sizeof(float); b++)
+      for (size_t i = 0; i < n; i++)
+        dst[b * n + i] = src[i * sizeof(float) + b];
+    return qCompress(planes, 1);
+  }
+
+  bool unpack_values(const char *data, size_t bytes, float *values, size_t n)
+  {
+    const QByteArray planes = qUncompress(reinterpret_cast<const uchar *>(data), static_cast<int>(bytes));
+    if (size_t(planes.size()) != n * sizeof(float))
+      return false;
+    const auto *src = reinterpret_cast<const uchar *>(planes.constData());
+    auto *dst = reinterpret_cast<uchar *>(values);
+    for (size_t b = 0; b < sizeof(float); b++)
+      for (size_t i = 0; i < n; i++)
+        dst[i * sizeof(float) + b] = src[b * n + i];
+    return true;
+  }
+
+  job_message job_of(uint32_t job_id, const offline_renderer::view &v, int tile_size_pow, kernel_tier tier)
+  {
+    job_message res;
+    res.job_id = job_id;
+    res.tile_size_pow = tile_size_pow;
+    res.center_x_hi = v.center_x.hi;
+    res.center_x_lo = v.center_x.lo;
+    res.center_y_hi = v.center_y.hi;
+    res.center_y_lo = v.center_y.lo;
+    res.pixel_scale = v.pixel_scale;
+    res.width = v.width;
+    res.height = v.height;
+    res.max_iterations = v.settings.max_iterations;
+    res.smooth = v.settings.smooth;
+    res.tier = static_cast<uint32_t>(tier);
+    return res;
+  }
+
+  offline_renderer::view view_of(const job_message &j)
+  {
+    offline_renderer::view res;
+    res.center_x = dd_real(j.center_x_hi, j.center_x_lo);
+    res.center_y = dd_real(j.center_y_hi, j.center_y_lo);
+    res.pixel_scale = j.pixel_scale;
+    res.width = j.width;
+    res.height = j.height;
+    res.settings.max_iterations = j.max_iterations;
+    res.settings.smooth = j.smooth != 0;
+    res.tier = static_cast<kernel_tier>(j.tier);
+    return res;
+  }
+
+  bool split_tcp_address(const QString &address, QString &host, quint16 &port)
+  {
+    const int colon = address.lastIndexOf(':');
+    if (colon < 0)
+      return false;
+    bool ok = false;
+    const unsigned p = address.mid(colon + 1).toUInt(&ok);
+    if (!ok || p == 0 || p > 65535)
+      return false;
+    host = address.left(colon);
+    port = static_cast<quint16>(p);
+    return true;
+  }
+
+  double seconds_between(clock::time_point begin, clock::time_point end)
+  {
+    return std::chrono::duration<double>(end - begin).count();
+  }
+}  // namespace
+
+bool render_farm::is_tcp_address(const QString &address)
+{
+  QString host;
+  quint16 port = 0;
+  return split_tcp_address(address, host, port);
+}
+
+/* Worker connected to the coordinator */
+struct render_farm::coordinator::connection
+{
+  QIODevice *socket = nullptr;
+  std::function<void()> abort;  // of the socket, discarding what is not written
+  QByteArray in;      // received, not a whole message yet
+  uint32_t job_id = 0;  // last job sent
+  std::vector<uint32_t> in_flight;  // tiles sent and not received
+  worker_report report;  // n_threads is 0 until its hello
+  clock::time_point since;  // connected or the render started
+  clock::time_point last_heard;  // received from it, or got tiles while it had none in flight
+};
+
+/* Render running: tiles are numbered row by row, bands are rows of superpixels */
+struct render_farm::coordinator::job
+{
+  struct band
+  {
+    std::vector<float> values;  // of the image rows
+    size_t remaining = 0;       // tiles not received
+  };
+
+  job(const offline_renderer::view &v, int tile_size_pow, const std::function<bool(const float *, int)> &row)
+    : v(v), tile_size(1 << tile_size_pow), cols((v.width + tile_size - 1) / tile_size),
+      n_bands((v.height + tile_size - 1) / tile_size), n_tiles(uint32_t(cols) * n_bands), row(row)
+  {
+  }
+
+  const offline_renderer::view v;
+  const int tile_size, cols, n_bands;
+  const uint32_t n_tiles;
+  const std::function<bool(const float *, int)> &row;
+  job_message msg;
+
+  int first_band = 0;       // next to hand out
+  std::deque<band> bands;   // first_band and the ones after it with tiles sent
+  uint32_t next_tile = 0;   // first one never sent
+  std::deque<uint32_t> retries;  // lost tiles, sent before the new ones
+  std::unordered_map<uint32_t, int> losses;
+  std::vector<float> tile_values;
+
+  QEventLoop loop;
+  QTimer no_workers;
+  QTimer watchdog;
+  bool is_finished = false, is_done = false;
+};
+
+render_farm::coordinator::coordinator(const QString &address, std::chrono::milliseconds result_timeout)
+    : result_timeout(result_timeout)
+{
+  QString host;
+  quint16 port = 0;
+  if (split_tcp_address(address, host, port))
+  {
+    tcp_server = std::make_unique<QTcpServer>();
+    QObject::connect(tcp_server.get(), &QTcpServer::newConnection, tcp_server.get(), [this] {
+      while (QTcpSocket *socket = tcp_server->nextPendingConnection())
+        accept(socket, socket->peerAddress().toString() + ":" + QString::number(socket->peerPort()));
+    });
+    const QHostAddress host_address = host.isEmpty() ? QHostAddress(QHostAddress::Any) : QHostAddress(host);
+    if (!tcp_server->listen(host_address, port))
+      error = tcp_server->errorString();
+  }
+  else
+  {
+    local_server = std::make_unique<QLocalServer>();
+    QObject::connect(local_server.get(), &QLocalServer::newConnection, local_server.get(), [this, address] {
+      while (QLocalSocket *socket = local_server->nextPendingConnection())
+        accept(socket, address + " #" + QString::number(++n_accepted));
+    });
+    QLocalServer::removeServer(address);  // left by a coordinator that crashed
+    if (!local_server->listen(address))
+      error = local_server->errorString();
+  }
+}
+
+render_farm::coordinator::~coordinator()
+{
+  for (auto &c : connections)
+  {
+    QObject::disconnect(c->socket, nullptr, nullptr, nullptr);
+    c->socket->close();
+  }
+}
+
+bool render_farm::coordinator::is_listening() const
+{
+  return tcp_server != nullptr ? tcp_server->isListening() : local_server->isListening();
+}
+
+template<class Socket>
+void render_farm::coordinator::accept(Socket *socket, const QString &name)
+{
+  auto c = std::make_unique<connection>();
+  c->socket = socket;
+  c->abort = [socket] { socket->abort(); };
+  c->report.name = name;
+  c->since = clock::now();
+  connection *p = c.get();
+  connections.push_back(std::move(c));
+  QObject::connect(socket, &QIODevice::readyRead, socket, [this, p] { on_ready_read(*p); });
+  QObject::connect(socket, &Socket::disconnected, socket, [this, p] { on_lost(*p); });
+  if (socket->bytesAvailable() > 0)
+    on_ready_read(*p);
+}
+
+void render_farm::coordinator::on_ready_read(connection &c)
+{
+  c.last_heard = clock::now();
+  c.in.append(c.socket->readAll());
+  const bool ok = take_messages(c.in, [this, &c](message_type type, const char *payload, size_t bytes) {
+    switch (type)
+    {
+    case message_type::HELLO:
+    {
+      hello_message h;
+      if (!read_message(payload, bytes, h) || h.version != protocol_version || h.n_threads == 0)
+        return false;
+      c.report.n_threads = h.n_threads;
+      return true;
+    }
+    case message_type::RESULT:
+      return on_result(c, payload, bytes);
+    default:
+      return false;
+    }
+  });
+  if (!ok)
+  {
+    c.socket->close();  // its tiles are sent to the others by on_lost, c is gone
+    return;
+  }
+  if (cur != nullptr)
+    dispatch();
+}
+
+bool render_farm::coordinator::on_result(connection &c, const char *payload, size_t bytes)
+{
+  result_message r;
+  if (!read_message(payload, bytes, r))
+    return false;
+  const auto it = std::find(c.in_flight.begin(), c.in_flight.end(), r.tile_id);
+  if (cur == nullptr || cur->is_finished || r.job_id != cur->msg.job_id || it == c.in_flight.end())
+    return true;  // of a render stopped early
+
+  job &j = *cur;
+  const size_t n = size_t(j.tile_size) * j.tile_size;
+  j.tile_values.resize(n);
+  if (r.n_values != n || !unpack_values(payload + sizeof(r), bytes - sizeof(r), j.tile_values.data(), n))
+    return false;
+  c.in_flight.erase(it);
+
+  // the part inside the image
+  job::band &b = j.bands[r.tile_id / j.cols - j.first_band];
+  const int x0 = static_cast<int>(r.tile_id % j.cols) * j.tile_size;
+  const int w = std::min(j.tile_size, j.v.width - x0), rows = static_cast<int>(b.values.size() / j.v.width);
+  for (int y = 0; y < rows; y++)
+    std::copy_n(j.tile_values.data() + size_t(y) * j.tile_size, w, b.values.data() + size_t(y) * j.v.width + x0);
+  b.remaining--;
+
+  c.report.tiles++;
+  c.report.pixels += size_t(w) * rows;
+  c.report.raw_bytes += n * sizeof(float);
+  c.report.payload_bytes += bytes - sizeof(r);
+  hand_out();
+  return true;
+}
+
+void render_farm::coordinator::on_lost(connection &c)
+{
+  c.report.is_connected = false;
+  if (cur != nullptr && !cur->is_finished)
+  {
+    job &j = *cur;
+    c.report.seconds = seconds_between(c.since, clock::now());
+    c.report.lost_tiles = c.in_flight.size();
+    lost_reports.push_back(c.report);
+    for (auto it = c.in_flight.rbegin(); it != c.in_flight.rend(); ++it)
+    {
+      if (++j.losses[*it] == max_tile_losses)
+      {
+        error = QString("a tile was lost with %1 workers").arg(max_tile_losses);
+        finish(false);
+      }
+      j.retries.push_front(*it);
+    }
+  }
+
+  c.socket->deleteLater();
+  connections.erase(std::find_if(connections.begin(), connections.end(),
+                                 [&c](const std::unique_ptr<connection> &p) { return p.get() == &c; }));
+  if (cur != nullptr)
+    dispatch();
+}
+
+void render_farm::coordinator::on_watchdog()
+{
+  const auto now = clock::now();
+  std::vector<connection *> silent;
+  for (auto &c : connections)
+    if (!c->in_flight.empty() && now - c->last_heard >= result_timeout)
+      silent.push_back(c.get());
+  for (connection *c : silent)
+  {
+    // a hung peer may never let the socket report the disconnection, so it is lost right away
+    QObject::disconnect(c->socket, nullptr, nullptr, nullptr);
+    c->abort();
+    c->report.is_timed_out = true;
+    on_lost(*c);
+  }
+}
+
+void render_farm::coordinator::dispatch()
+{
+  job &j = *cur;
+  if (j.is_finished)
+    return;
+  unsigned n_threads = 0;
+  for (auto &c : connections)
+    n_threads += c->report.n_threads;
+  if (n_threads == 0)
+  {
+    if (!j.no_workers.isActive())
+      j.no_workers.start();
+    return;
+  }
+  j.no_workers.stop();
+
+  // bands received ahead of the one handed out: twice as many tiles as worker threads
+  const int bands_ahead = std::max<int>(2, (2 * n_threads + j.cols - 1) / j.cols);
+  // a tile to every worker with room for it in turn
+  for (bool is_sent = true; is_sent;)
+  {
+    is_sent = false;
+    for (auto &c : connections)
+    {
+      if (c->in_flight.size() >= 2 * c->report.n_threads)
+        continue;
+      uint32_t tile_id;
+      if (!j.retries.empty())
+      {
+        tile_id = j.retries.front();
+        j.retries.pop_front();
+      }
+      else if (j.next_tile < j.n_tiles && static_cast<int>(j.next_tile / j.cols) < j.first_band + bands_ahead)
+      {
+        tile_id = j.next_tile++;
+        const int band = static_cast<int>(tile_id / j.cols);
+        if (band - j.first_band == static_cast<int>(j.bands.size()))
+        {
+          const int rows = std::min(j.tile_size, j.v.height - band * j.tile_size);
+          j.bands.push_back({std::vector<float>(size_t(rows) * j.v.width), size_t(j.cols)});
+        }
+      }
+      else
+        return;
+
+      if (c->job_id != j.msg.job_id)
+      {
+        c->socket->write(message(message_type::JOB, j.msg));
+        c->job_id = j.msg.job_id;
+      }
+      if (c->in_flight.empty())
+        c->last_heard = clock::now();  // silence counts from the first tile in flight
+      tile_message t;
+      t.job_id = j.msg.job_id;
+      t.tile_id = tile_id;
+      t.x = static_cast<int>(tile_id % j.cols) * j.tile_size;
+      t.y = static_cast<int>(tile_id / j.cols) * j.tile_size;
+      c->socket->write(message(message_type::TILE, t));
+      c->in_flight.push_back(tile_id);
+      is_sent = true;
+    }
+  }
+}
+
+void render_farm::coordinator::hand_out()
+{
+  job &j = *cur;
+  while (!j.bands.empty() && j.bands.front().remaining == 0)
+  {
+    const std::vector<float> &values = j.bands.front().values;
+    const int y0 = j.first_band * j.tile_size, rows = static_cast<int>(values.size() / j.v.width);
+    for (int y = 0; y < rows; y++)
+      if (!j.row(values.data() + size_t(y) * j.v.width, y0 + y))
+      {
+        finish(false);
+        return;
+      }
+    j.bands.pop_front();
+    j.first_band++;
+  }
+  if (j.first_band == j.n_bands)
+    finish(true);
+}
+
+void render_farm::coordinator::finish(bool is_done)
+{
+  if (cur->is_finished)
+    return;
+  cur->is_finished = true;
+  cur->is_done = is_done;
+  cur->no_workers.stop();
+  cur->watchdog.stop();
+  cur->loop.quit();
+}
+
+bool render_farm::coordinator::render(const offline_renderer::view &v, int tile_size_pow,
+                                      const std::function<bool(const float *, int)> &row)
+{
+  if (!is_listening())
+    return false;
+  error.clear();
+  lost_reports.clear();
+  const auto begin = clock::now();
+  for (auto &c : connections)
+  {
+    c->report = {c->report.name, c->report.n_threads};
+    c->since = begin;
+  }
+
+  job j(v, tile_size_pow, row);
+  const kernel_tier tier = v.tier ? *v.tier : kernel_tiers::calibrated().select(v.pixel_scale);
+  j.msg = job_of(++last_job_id, v, tile_size_pow, tier);
+  j.no_workers.setSingleShot(true);
+  j.no_workers.setInterval(static_cast<int>(std::chrono::milliseconds(worker_timeout).count()));
+  QObject::connect(&j.no_workers, &QTimer::timeout, &j.no_workers, [this] {
+    error = "no worker connected";
+    finish(false);
+  });
+  j.watchdog.setInterval(static_cast<int>(
+      std::clamp(result_timeout / 4, std::chrono::milliseconds(10), std::chrono::milliseconds(1000)).count()));
+  QObject::connect(&j.watchdog, &QTimer::timeout, &j.watchdog, [this] { on_watchdog(); });
+  j.watchdog.start();
+  cur = &j;
+  if (j.n_tiles == 0)
+    finish(true);
+  dispatch();
+  if (!j.is_finished)
+    j.loop.exec();
+  cur = nullptr;
+
+  const auto end = clock::now();
+  for (auto &c : connections)
+  {
+    c->report.seconds = seconds_between(c->since, end);
+    c->in_flight.clear();  // results of a render stopped early are ignored
+  }
+  return j.is_done;
+}
+
+std::vector<render_farm::worker_report> render_farm::coordinator::get_reports() const
+{
+  std::vector<worker_report> res;
+  for (auto &c : connections)
+    res.push_back(c->report);
+  res.insert(res.end(), lost_reports.begin(), lost_reports.end());
+  return res;
+}
+
+bool render_farm::run_worker(const QString &address, offline_renderer &renderer, QString &error, size_t max_results)
+{
+  error.clear();
+  QEventLoop loop;
+  bool is_closed = false;
+  auto on_closed = [&loop, &is_closed] {
+    is_closed = true;
+    loop.quit();
+  };
+
+  std::unique_ptr<QIODevice> socket;
+  QString host;
+  quint16 port = 0;
+  if (split_tcp_address(address, host, port))
+  {
+    auto s = std::make_unique<QTcpSocket>();
+    s->connectToHost(host.isEmpty() ? QString("127.0.0.1") : host, port);
+    if (!s->waitForConnected(connect_timeout_ms))
+    {
+      error = s->errorString();
+      return false;
+    }
+    QObject::connect(s.get(), &QTcpSocket::disconnected, &loop, on_closed);
+    socket = std::move(s);
+  }
+  else
+  {
+    auto s = std::make_unique<QLocalSocket>();
+    s->connectToServer(address);
+    if (!s->waitForConnected(connect_timeout_ms))
+    {
+      error = s->errorString();
+      return false;
+    }
+    QObject::connect(s.get(), &QLocalSocket::disconnected, &loop, on_closed);
+    socket = std::move(s);
+  }
+
+  // tiles are rendered in batches, the results of one are sent while the next one renders
+  std::mutex m;
+  std::condition_variable cv;
+  job_message job;  // of the tiles
+  std::deque<tile_message> tiles;
+  bool is_quit = false;
+  std::shared_mutex engine_m;  // batches share the renderer, a new superpixel size takes it alone
+  auto is_stale = [&](const job_message &j) {
+    std::lock_guard lg(m);
+    return j.job_id != job.job_id;
+  };
+
+  QIODevice *out = socket.get();
+  size_t n_results = 0;
+  // on the event loop thread
+  auto send_result = [&](const QByteArray &msg) {
+    if (!out->isOpen())
+      return;
+    out->write(msg);
+    if (++n_results == max_results)
+      out->close();  // after the pending data is written
+  };
+  const size_t batch_size = renderer.get_n_workers();
+  auto render_batches = [&] {
+    for (;;)
+    {
+      job_message j;
+      std::vector<tile_message> batch;
+      {
+        std::unique_lock lg(m);
+        cv.wait(lg, [&] { return is_quit || !tiles.empty(); });
+        if (is_quit)
+          return;
+        j = job;
+        const int mip_level = tiles.front().mip_level;
+        while (!tiles.empty() && batch.size() < batch_size && tiles.front().mip_level == mip_level)
+        {
+          batch.push_back(tiles.front());
+          tiles.pop_front();
+        }
+      }
+
+      std::vector<QPoint> corners;
+      for (const tile_message &t : batch)
+        corners.emplace_back(t.x, t.y);
+      const int mip_level = batch.front().mip_level;
+      const size_t n = size_t(1) << 2 * (j.tile_size_pow - mip_level);
+      std::shared_lock engine_lock(engine_m);
+      while (renderer.get_tile_size_pow() != j.tile_size_pow && !is_stale(j))
+      {
+        // the first batch of a job sets its superpixel size here, not the socket thread, which has to keep
+        // sending results meanwhile: it waits until the batches of the last job are done
+        engine_lock.unlock();
+        {
+          std::unique_lock resize_lock(engine_m);
+          if (renderer.get_tile_size_pow() != j.tile_size_pow && !is_stale(j))
+            renderer.set_tile_size_pow(j.tile_size_pow);
+        }
+        engine_lock.lock();
+      }
+      if (renderer.get_tile_size_pow() != j.tile_size_pow)
+        continue;  // of a render stopped early
+      renderer.render_tiles(view_of(j), corners, mip_level, [&](size_t i, const float *values) {
+        result_message r;
+        r.job_id = j.job_id;
+        r.tile_id = batch[i].tile_id;
+        r.n_values = static_cast<uint32_t>(n);
+        const QByteArray msg = message(message_type::RESULT, r, pack_values(values, n));
+        QMetaObject::invokeMethod(out, [&send_result, msg] { send_result(msg); }, Qt::QueuedConnection);
+      });
+    }
+  };
+
+  auto on_message = [&](message_type type, const char *payload, size_t bytes) {
+    switch (type)
+    {
+    case message_type::JOB:
+    {
+      job_message j;
+      if (!read_message(payload, bytes, j) || !tile_size::is_valid(j.tile_size_pow) || j.width <= 0 ||
+          j.height <= 0 || j.max_iterations <= 0 || !(j.pixel_scale > 0) ||
+          j.tier > static_cast<uint32_t>(kernel_tier::PERTURBATION))
+        return false;
+      std::lock_guard lg(m);
+      tiles.clear();  // of a render stopped early
+      job = j;
+      return true;
+    }
+    case message_type::TILE:
+    {
+      tile_message t;
+      if (!read_message(payload, bytes, t) || t.mip_level < 0)
+        return false;
+      std::lock_guard lg(m);
+      if (t.job_id != job.job_id || t.mip_level > job.tile_size_pow)
+        return false;
+      tiles.push_back(t);
+      cv.notify_one();
+      return true;
+    }
+    default:
+      return false;
+    }
+  };
+
+  QByteArray in;
+  QObject::connect(out, &QIODevice::readyRead, &loop, [&] {
+    in.append(out->readAll());
+    if (!take_messages(in, on_message))
+    {
+      error = "bad message from the coordinator";
+      out->close();
+    }
+  });
+
+  std::vector<std::thread> batches;
+  for (int i = 0; i < 2; i++)
+    batches.emplace_back(render_batches);
+  hello_message hello;
+  hello.n_threads = renderer.get_n_workers();
+  out->write(message(message_type::HELLO, hello));
+  if (!is_closed)
+    loop.exec();
+
+  {
+    std::lock_guard lg(m);
+    is_quit = true;
+  }
+  cv.notify_all();
+  for (auto &th : batches)
+    th.join();
+  return error.isEmpty();
+}
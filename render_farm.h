@@ -0,0 +1,111 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <QString>
+
+#include "offline_renderer.h"
+
+class QLocalServer;
+class QTcpServer;
+
+/* Offline renders split across worker processes: the coordinator listens on a local (Unix domain) socket or
+ * a TCP port, workers connect to it and render superpixels with an offline_renderer of their own.
+ * A render is sent to every worker as a job (the view, iteration limit and superpixel size), then as tile
+ * descriptors (upper left pixel and mip level), at most two per worker thread in flight; workers send back
+ * the iteration values of every tile compressed. Tiles in flight on a worker that disconnects are sent
+ * to the others again, as are the ones of a worker sending nothing for the result timeout (hung or unreachable).
+ * Rows are handed out top to bottom as by offline_renderer::render, only the bands
+ * of superpixels in flight are kept in memory. The kernel tier of the view is picked by the coordinator
+ * (see kernel_tiers), so workers measuring other thresholds still render it alike, without seams.
+ * Messages are fixed-layout structs in the byte order of the hosts, which must match (little-endian ones) */
+namespace render_farm
+{
+  // "host:port" (host is an IP address, none for every interface) is a TCP address,
+  // anything else is the name of a local socket
+  bool is_tcp_address(const QString &address);
+
+  /* Throughput of a worker over the last render */
+  struct worker_report
+  {
+    QString name;  // peer address
+    unsigned n_threads = 0;
+    uint64_t tiles = 0;  // received from it
+    uint64_t pixels = 0;
+    uint64_t raw_bytes = 0;      // of the iteration values received
+    uint64_t payload_bytes = 0;  // of the same compressed
+    uint64_t lost_tiles = 0;     // in flight when it disconnected, sent to the others again
+    double seconds = 0;          // connected during the render
+    bool is_connected = true;    // at the end of the render
+    bool is_timed_out = false;   // dropped by the coordinator for sending nothing
+  };
+
+  class coordinator
+  {
+  public:
+    // a render fails when no worker is connected for that long
+    static constexpr std::chrono::seconds worker_timeout{30};
+    // ... or when a tile is lost with that many workers
+    static constexpr int max_tile_losses = 3;
+    // a worker with tiles in flight sending nothing for that long is dropped, its tiles are sent to the others
+    static constexpr std::chrono::seconds default_result_timeout{60};
+
+    // result_timeout must exceed the render time of any superpixel
+    explicit coordinator(const QString &address,
+                         std::chrono::milliseconds result_timeout = default_result_timeout);
+    coordinator(const coordinator &) = delete;
+    coordinator &operator=(const coordinator &) = delete;
+    ~coordinator();  // workers quit when disconnected
+
+    bool is_listening() const;
+    QString error_string() const
+    {
+      return error;
+    }
+
+    /* Renders v with superpixels of 1 << tile_size_pow pixels on the workers connected and connecting meanwhile,
+     * running an event loop. Hands out the rows as offline_renderer::render does and returns whether all of them
+     * were handed out, see error_string() if not stopped by row. pre: tile_size::is_valid(tile_size_pow) */
+    bool render(const offline_renderer::view &v, int tile_size_pow,
+                const std::function<bool(const float *, int)> &row);
+
+    // workers of the last render, the ones disconnected during it included
+    std::vector<worker_report> get_reports() const;
+
+  private:
+    struct connection;
+    struct job;
+
+    template<class Socket>
+    void accept(Socket *socket, const QString &name);
+    void on_ready_read(connection &c);
+    bool on_result(connection &c, const char *payload, size_t bytes);
+    void on_lost(connection &c);
+    // drops the workers silent for result_timeout with tiles in flight
+    void on_watchdog();
+    // sends tiles to the workers with room for them
+    void dispatch();
+    // hands out the complete bands at the top
+    void hand_out();
+    void finish(bool is_done);
+
+    std::unique_ptr<QTcpServer> tcp_server;
+    std::unique_ptr<QLocalServer> local_server;
+    QString error;
+    const std::chrono::milliseconds result_timeout;
+    std::vector<std::unique_ptr<connection>> connections;
+    std::vector<worker_report> lost_reports;  // of the workers disconnected during the last render
+    unsigned n_accepted = 0;
+    uint32_t last_job_id = 0;
+    job *cur = nullptr;  // of the render running
+  };
+
+  /* Renders the tiles of the coordinator at address on renderer until the coordinator disconnects,
+   * running an event loop. Returns false if it could not connect or got a bad message, see error.
+   * For tests, a max_results other than 0 disconnects after sending that many results, as a worker dying
+   * with superpixels in flight */
+  bool run_worker(const QString &address, offline_renderer &renderer, QString &error, size_t max_results = 0);
+}  // namespace render_farm
@@ -0,0 +1,114 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <QCoreApplication>
+#include <QFile>
+#include <QProcess>
+#include <QRegularExpression>
+#include <QTemporaryDir>
+#include <QThread>
+
+/* Render farm test, run by ctest with the path of mandelbrot_render:
+ * renders a view with a coordinator listening on a local socket of its own and three workers it starts,
+ * the first of which disconnects after its first result as if it died, and checks that the superpixels it had
+ * in flight were sent to the others and that the image is byte for byte the one rendered by a single process */
+namespace
+{
+  constexpr int width = 768, height = 768, tile_size = 64;
+  constexpr int n_workers = 3, worker_threads = 2;
+  constexpr int timeout_ms = 300000;
+
+  int fail(const std::string &what)
+  {
+    std::cerr << "FAIL: " << what << std::endl;
+    return 1;
+  }
+
+  QByteArray read_all(const QString &path)
+  {
+    QFile f(path);
+    return f.open(QIODevice::ReadOnly) ? f.readAll() : QByteArray();
+  }
+
+  // starts a worker, again while the coordinator is not listening yet
+  bool start_worker(QProcess &worker, const QString &render, const QString &address, const QStringList &options)
+  {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    do
+    {
+      worker.start(render, QStringList{"--farm-worker", address, "-j", QString::number(worker_threads)} + options);
+      if (!worker.waitForStarted())
+        return false;
+      if (!worker.waitForFinished(500) || worker.exitCode() == 0)
+        return true;  // connected and rendering, or done with the results it was allowed
+      QThread::msleep(100);
+    } while (std::chrono::steady_clock::now() < deadline);
+    return false;
+  }
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  if (argc != 2)
+  {
+    std::cerr << "usage: mandelbrot_farm_test path/to/mandelbrot_render" << std::endl;
+    return 2;
+  }
+  const QString render = QString::fromLocal8Bit(argv[1]);
+  QTemporaryDir dir;
+  if (!dir.isValid())
+    return fail("no temporary directory");
+  const QString single_path = dir.filePath("single.ppm"), farm_path = dir.filePath("farm.ppm");
+  // boundary-heavy and far from the kernel tier thresholds, so both renders take the plain double tier
+  const QStringList view = {"--center-x=-0.743643887037", "--center-y=0.131825904205", "--scale=2e-8",
+                            "-W", QString::number(width), "-H", QString::number(height), "-i", "4000",
+                            "--tile-size", QString::number(tile_size)};
+
+  QProcess single;
+  single.setProcessChannelMode(QProcess::ForwardedChannels);
+  single.start(render, view + QStringList{single_path});
+  if (!single.waitForFinished(timeout_ms) || single.exitStatus() != QProcess::NormalExit || single.exitCode() != 0)
+    return fail("single process render");
+
+  const QString address = QString("mandelbrot_farm_test_%1").arg(QCoreApplication::applicationPid());
+  QProcess coordinator;
+  coordinator.start(render, view + QStringList{"--listen", address, farm_path});
+  if (!coordinator.waitForStarted())
+    return fail("cannot start the coordinator");
+  std::vector<std::unique_ptr<QProcess>> workers;
+  for (int i = 0; i < n_workers; i++)
+  {
+    workers.push_back(std::make_unique<QProcess>());
+    workers.back()->setProcessChannelMode(QProcess::ForwardedChannels);
+    // the first one to connect gets superpixels before the others and dies with all but one of them
+    const QStringList options = i == 0 ? QStringList{"--farm-worker-results", "1"} : QStringList();
+    if (!start_worker(*workers.back(), render, address, options))
+      return fail("cannot start a worker");
+  }
+
+  if (!coordinator.waitForFinished(timeout_ms) || coordinator.exitStatus() != QProcess::NormalExit ||
+      coordinator.exitCode() != 0)
+  {
+    std::cerr << coordinator.readAllStandardError().constData();
+    return fail("farm render");
+  }
+  const QString report = QString::fromLocal8Bit(coordinator.readAllStandardOutput());
+  std::cout << report.toStdString();
+  for (auto &w : workers)
+    w->waitForFinished();
+
+  // the dead worker's line: ", disconnected with N superpixels"
+  const QRegularExpressionMatch lost = QRegularExpression("disconnected with (\\d+) superpixels").match(report);
+  if (!lost.hasMatch())
+    return fail("the dead worker is not reported");
+  if (lost.captured(1).toInt() == 0)
+    return fail("the dead worker had no superpixels in flight to retry");
+
+  const QByteArray single_image = read_all(single_path), farm_image = read_all(farm_path);
+  if (single_image.isEmpty() || single_image != farm_image)
+    return fail("the farm image differs from the single process one");
+  std::cout << "PASS: " << lost.captured(1).toStdString() << " superpixels retried, images identical" << std::endl;
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#elif defined(MANDELBROT_HUGE_PAGES) && defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "slab_arena.h"
+
+static void *aligned_allocate(size_t alignment, size_t bytes)
+{
+#if defined(_MSC_VER)
+  void *res = _aligned_malloc(bytes, alignment);
+#else
+  void *res = std::aligned_alloc(alignment, bytes);
+#endif
+  if (res == nullptr)
+    throw std::bad_alloc();
+  return res;
+}
+
+static void aligned_free(void *p)
+{
+#if defined(_MSC_VER)
+  _aligned_free(p);
+#else
+  std::free(p);
+#endif
+}
+
+slab_arena::~slab_arena()
+{
+  for (void *slab : slabs)
+    aligned_free(slab);
+}
+
+slab_arena &slab_arena::global()
+{
+  static slab_arena arena;
+  return arena;
+}
+
+size_t slab_arena::class_of(size_t bytes)
+{
+  size_t pow = min_class_pow;
+  while ((size_t(1) << pow) < bytes)
+    pow++;
+  return pow - min_class_pow;
+}
+
+size_t slab_arena::block_size(size_t bytes)
+{
+  if (bytes > slab_size)
+    return (bytes + alignment - 1) / alignment * alignment;
+  return size_t(1) << (class_of(bytes) + min_class_pow);
+}
+
+void *slab_arena::allocate_slab(size_t bytes)
+{
+  void *res = aligned_allocate(bytes >= slab_size ? slab_size : alignment, bytes);
+#if defined(MANDELBROT_HUGE_PAGES) && defined(__linux__)
+  if (bytes >= slab_size)
+    madvise(res, bytes, MADV_HUGEPAGE);
+#endif
+  resident.fetch_add(bytes, std::memory_order_relaxed);
+  return res;
+}
+
+void *slab_arena::allocate(size_t bytes)
+{
+  const size_t block = block_size(bytes);
+  used.fetch_add(block, std::memory_order_relaxed);
+  if (block > slab_size)
+    return allocate_slab(block);
+
+  size_class &c = classes[class_of(bytes)];
+  {
+    std::lock_guard lg(c.m);
+    if (!c.free.empty())
+    {
+      void *res = c.free.back();
+      c.free.pop_back();
+      return res;
+    }
+  }
+
+  // carve a new slab, keep the first block
+  char *slab = static_cast<char *>(allocate_slab(slab_size));
+  {
+    std::lock_guard lg(slabs_m);
+    slabs.push_back(slab);
+  }
+  std::lock_guard lg(c.m);
+  for (size_t offset = slab_size - block; offset > 0; offset -= block)
+    c.free.push_back(slab + offset);
+  return slab;
+}
+
+void slab_arena::deallocate(void *p, size_t bytes)
+{
+  assert(p != nullptr);
+  const size_t block = block_size(bytes);
+  used.fetch_sub(block, std::memory_order_relaxed);
+  if (block > slab_size)
+  {
+    aligned_free(p);
+    resident.fetch_sub(block, std::memory_order_relaxed);
+    return;
+  }
+
+  size_class &c = classes[class_of(bytes)];
+  std::lock_guard lg(c.m);
+  c.free.push_back(p);
+}
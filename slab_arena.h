@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/* (Multi-thread safe) allocator of blocks with power of 2 sizes from large slabs:
+ * every size class carves its own slabs into equal blocks and keeps a free list of them,
+ * so level-sized mip buffers are recycled without heap traffic or fragmentation.
+ * Blocks are aligned to 64 bytes (cache line), slabs to their size, and with
+ * MANDELBROT_HUGE_PAGES slabs are advised to be backed by transparent huge pages (Linux).
+ * Slabs are kept until the arena is destroyed. */
+class slab_arena
+{
+public:
+  static constexpr size_t alignment = 64;
+  static constexpr size_t slab_size = size_t(2) << 20;  // huge page size on x86-64
+
+  slab_arena() = default;
+  slab_arena(const slab_arena &) = delete;
+  slab_arena &operator=(const slab_arena &) = delete;
+  ~slab_arena();
+
+  // arena of all superpixel buffers
+  static slab_arena &global();
+
+  // size of block serving `bytes`
+  static size_t block_size(size_t bytes);
+
+  void *allocate(size_t bytes);
+  // pre: p was allocated for the same `bytes`
+  void deallocate(void *p, size_t bytes);
+
+  // memory taken from the system
+  size_t resident_bytes() const
+  {
+    return resident.load(std::memory_order_relaxed);
+  }
+  // memory in allocated blocks
+  size_t used_bytes() const
+  {
+    return used.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr size_t min_class_pow = 6;  // 64 bytes
+  static constexpr size_t max_class_pow = 21;  // slab_size, larger blocks get their own allocation
+  static constexpr size_t n_classes = max_class_pow - min_class_pow + 1;
+
+  static size_t class_of(size_t bytes);
+  void *allocate_slab(size_t bytes);
+
+  struct size_class
+  {
+    std::mutex m;
+    std::vector<void *> free;
+  };
+  std::array<size_class, n_classes> classes;
+
+  std::mutex slabs_m;
+  std::vector<void *> slabs;
+  std::atomic<size_t> resident = 0, used = 0;
+};
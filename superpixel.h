@@ -1,38 +1,56 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
 #include <QTypeInfo>
 #include <QPoint>
 
+#include "slab_arena.h"
+
 namespace pixel_helper
 {
-  struct color
+  /* Pixel of QImage::Format_RGB32 (0xffRRGGBB in native byte order), so screen buffers are shown without conversion */
+  struct alignas(4) color
   {
     union
     {
       struct
       {
-        uchar r, g, b;
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+        uchar a, r, g, b;
+#else
+        uchar b, g, r, a;
+#endif
       };
-      uchar data[3];
+      uint32_t argb;
     };
 
     color() = default;
-    color(uchar r, uchar g, uchar b) noexcept : r(r), g(g), b(b) {}
-    color(qreal r, qreal g, qreal b) noexcept : r(r * 255), g(g * 255), b(b * 255) {}
+    color(uchar r, uchar g, uchar b) noexcept : argb(0xFF000000u | uint32_t(r) << 16 | uint32_t(g) << 8 | b) {}
+    color(qreal r, qreal g, qreal b) noexcept : color(uchar(r * 255), uchar(g * 255), uchar(b * 255)) {}
 
-    operator uchar *() noexcept
+    bool operator==(const color &other) const noexcept
     {
-      return data;
+      return argb == other.argb;
     }
-    operator const uchar *() const noexcept
+    bool operator!=(const color &other) const noexcept
     {
-      return data;
+      return !(*this == other);
     }
   };
 }  // namespace pixel_helper
 
-template<class PixelColorGetter, size_t Size>
+/* Square of Size x Size pixels of type Pixel (color or raw value) with its last rendered mip level.
+ * PixelColorGetter is either a per-point getter: Pixel(QPointF),
+ * or a row getter: void(Pixel *out, QPointF start, QPointF step, size_t count),
+ * filling out[i] with the pixel at start + i * step.
+ * Rendering is split from the superpixel: next_job() describes the next finer mip level,
+ * the job renders it into a new buffer with no access to the superpixel, and publish() swaps that buffer in.
+ * Published buffers are never written again, so they can be read while the next level renders. */
+template<class PixelColorGetter, size_t Size, typename Pixel = pixel_helper::color>
 class superpixel
 {
 public:
@@ -43,69 +61,338 @@ public:
     return size >> mip_level;
   }
 
+  static_assert(std::is_trivially_copyable_v<Pixel> && std::is_trivially_destructible_v<Pixel>,
+                "Pixel is stored in raw arena blocks");
+
+  // cols_per_line(level)^2 pixels of one mip level, 64-byte aligned block of slab_arena::global()
+  using mip_buffer = Pixel[];
+
+  static constexpr size_t mip_level_bytes(int mip_level)
+  {
+    return cols_per_line(mip_level) * cols_per_line(mip_level) * sizeof(Pixel);
+  }
+
+  /* Sample grid of mip levels:
+   * CENTERED - samples at pixel centers, every level is computed from scratch;
+   * NESTED - samples at pixel upper left corners, so every sample of a level is also a sample
+   *   of the next finer one, which computes only 3 new samples per 2x2 block */
+  enum class sample_grid
+  {
+    CENTERED,
+    NESTED
+  };
+
+  /* Render mode of a mip level:
+   * DENSE - every pixel is computed;
+   * SUBDIVIDE - Mariani-Silver: computes the border of a rectangle, fills the interior
+   *   if all border pixels are equal, otherwise splits it into quadrants recursively */
+  enum class render_mode
+  {
+    DENSE,
+    SUBDIVIDE
+  };
+
+  /* Read-only description of rendering one mip level */
+  struct render_job
+  {
+    QPointF ul_corner;
+    qreal scale;
+    int mip_level;
+    sample_grid grid;
+    render_mode mode;
+    PixelColorGetter func;
+    std::shared_ptr<const mip_buffer> parent;  // next coarser level with the same samples (NESTED grid)
+
+    // returns the rendered level, or nullptr if cancelled by callback
+    template<class LineCallback>
+    std::shared_ptr<const mip_buffer> render(LineCallback &&callback) const;
+
+    void get_line(Pixel *out, QPointF start, QPointF step, size_t count) const
+    {
+      if constexpr (is_row_getter)
+        func(out, start, step, count);
+      else
+        for (size_t i = 0; i < count; i++)
+          out[i] = func(start + step * qreal(i));
+    }
+  };
+
   superpixel(PixelColorGetter func = {}, QPointF ul_corner = {-2., -2.}, qreal scale = 4.)
       : ul_corner(ul_corner), scale(scale), func(std::move(func))
   {
   }
 
+  void set_func(PixelColorGetter new_func)
+  {
+    func = std::move(new_func);
+  }
+
+  // next job renders mip_level from scratch
   void set_mip_level(int mip_level)
   {
     last_mip_level = mip_level + 1;
+    mip_data.reset();
   }
 
-  template<class LineCallback>
-  bool render_mip_level(LineCallback &&callback) const
+  render_job next_job() const
   {
-    --last_mip_level;
+    return {ul_corner, scale, last_mip_level - 1, grid, mode, func,
+            grid == sample_grid::NESTED ? mip_data : nullptr};
+  }
 
-    pixel_helper::color *data = get_mip_data();
+  void publish(const render_job &job, std::shared_ptr<const mip_buffer> data)
+  {
+    mip_data = std::move(data);
+    last_mip_level = job.mip_level;
+  }
 
-    size_t off = 0;
-    for (size_t y = 0, off = 0; y < cols_per_line(last_mip_level); y++)
-    {
-      for (size_t x = 0; x < cols_per_line(last_mip_level); x++)
-        data[off++] = func(ul_corner + QPointF((x + 0.5) * 1.0 / cols_per_line(last_mip_level),
-                                               (y + 0.5) * 1.0 / cols_per_line(last_mip_level)) *
-                                           scale);
-      if (callback())
-        return false;
-    }
-    return true;
+  // publishes an already rendered mip level
+  void publish(int mip_level, std::shared_ptr<const mip_buffer> data)
+  {
+    mip_data = std::move(data);
+    last_mip_level = mip_level;
   }
 
-  pixel_helper::color *get_mip_data() const
+  // mip_level filled by fill(Pixel *data, size_t bytes) without rendering, nullptr if it returns false; publish() it
+  template<class Fill>
+  static std::shared_ptr<const mip_buffer> filled(int mip_level, Fill &&fill)
   {
-    assert(last_mip_level != -1);
+    std::shared_ptr<mip_buffer> data = allocate_buffer(mip_level);
+    if (!fill(data.get(), mip_level_bytes(mip_level)))
+      return nullptr;
+    return data;
+  }
 
-    size_t offset = 0, s = size * size;
-    for (int i = 0; i < last_mip_level; i++, s /= 4)
-      offset += s;
-    return mip_data.data() + offset;
+  // last rendered mip level, or nullptr
+  const Pixel *get_mip_data() const
+  {
+    return mip_data.get();
   }
 
-  void clear()
+  const std::shared_ptr<const mip_buffer> &get_mip_buffer() const
   {
-    last_mip_level = -1;
+    return mip_data;
   }
 
-  void copy_mip_data(superpixel &other)
+  // memory held by this superpixel and its rendered level
+  size_t resident_bytes() const
   {
-    mip_data = other.mip_data;
-    last_mip_level = other.last_mip_level;
+    return sizeof(*this) + (mip_data != nullptr ? slab_arena::block_size(mip_level_bytes(last_mip_level)) : 0);
+  }
+
+  void clear()
+  {
+    last_mip_level = -1;
+    mip_data.reset();
   }
 
   QPointF ul_corner;
   qreal scale;
-  mutable int last_mip_level = -1;
+  sample_grid grid = sample_grid::CENTERED;
+  render_mode mode = render_mode::DENSE;
+  int last_mip_level = -1;
 
 private:
+  // rectangles with no more pixels along a side are computed densely
+  static constexpr size_t subdivision_min_size = 4;
+
+  static constexpr bool is_row_getter =
+      std::is_invocable_v<const PixelColorGetter &, Pixel *, QPointF, QPointF, size_t>;
+
+  // block is returned to the arena when the last superpixel or job holding it releases it
+  static std::shared_ptr<mip_buffer> allocate_buffer(int mip_level)
+  {
+    const size_t bytes = mip_level_bytes(mip_level);
+    return std::shared_ptr<mip_buffer>(static_cast<Pixel *>(slab_arena::global().allocate(bytes)),
+                                       [bytes](Pixel *p) { slab_arena::global().deallocate(p, bytes); });
+  }
+
+  template<class LineCallback>
+  class subdivider
+  {
+  public:
+    subdivider(const render_job &job, Pixel *data, const Pixel *parent, size_t cols,
+               qreal offset, LineCallback &callback)
+        : job(job), data(data), cols(cols), offset(offset), callback(callback)
+    {
+      if (parent != nullptr)
+        for (size_t y = 0; y < cols; y += 2)
+          for (size_t x = 0; x < cols; x += 2)
+          {
+            data[y * cols + x] = parent[y / 2 * (cols / 2) + x / 2];
+            set_known(x, y);
+          }
+    }
+
+    // returns false if cancelled by callback
+    bool run()
+    {
+      size_t last = cols - 1;
+      return eval_span(0, 0, 1, 0, cols) && eval_span(0, last, 1, 0, cols) && eval_span(0, 1, 0, 1, cols - 2) &&
+             eval_span(last, 1, 0, 1, cols - 2) && subdivide(0, 0, last, last);
+    }
+
+  private:
+    bool is_known(size_t x, size_t y) const
+    {
+      return known[(y * cols + x) / 64] >> ((y * cols + x) % 64) & 1;
+    }
+    void set_known(size_t x, size_t y)
+    {
+      known[(y * cols + x) / 64] |= uint64_t(1) << ((y * cols + x) % 64);
+    }
+
+    // accounts done pixels, asking callback about cancellation once per line worth of them
+    bool progress(size_t pixels)
+    {
+      done += pixels;
+      if (done < cols)
+        return true;
+      done %= cols;
+      return !callback();
+    }
+
+    // computes unknown pixels among (x + i * dx, y + i * dy), i in [0, count),
+    // in runs of equally spaced pixels (coarser level leaves every other pixel of a line known)
+    bool eval_span(size_t x, size_t y, size_t dx, size_t dy, size_t count)
+    {
+      size_t unknown[size], n = 0;
+      for (size_t i = 0; i < count; i++)
+        if (!is_known(x + i * dx, y + i * dy))
+          unknown[n++] = i;
+
+      Pixel run[size];
+      const qreal pixel_scale = job.scale / cols;
+      for (size_t first = 0; first < n;)
+      {
+        size_t stride = first + 1 < n ? unknown[first + 1] - unknown[first] : 1, last = first + 1;
+        while (last < n && unknown[last] - unknown[last - 1] == stride)
+          last++;
+
+        size_t i0 = unknown[first];
+        job.get_line(run, job.ul_corner + QPointF(x + i0 * dx + offset, y + i0 * dy + offset) * pixel_scale,
+                     QPointF(dx * stride, dy * stride) * pixel_scale, last - first);
+        for (size_t k = first; k < last; k++)
+        {
+          size_t px = x + unknown[k] * dx, py = y + unknown[k] * dy;
+          data[py * cols + px] = run[k - first];
+          set_known(px, py);
+        }
+        first = last;
+      }
+      return progress(n);
+    }
+    // border of rectangle [x0, x1] x [y0, y1] is known
+    bool subdivide(size_t x0, size_t y0, size_t x1, size_t y1)
+    {
+      if (x1 - x0 < 2 || y1 - y0 < 2)
+        return true;
+
+      if (is_uniform(x0, y0, x1, y1))
+      {
+        const Pixel value = data[y0 * cols + x0];
+        for (size_t y = y0 + 1; y < y1; y++)
+          std::fill(data + y * cols + x0 + 1, data + y * cols + x1, value);
+        return progress((x1 - x0 - 1) * (y1 - y0 - 1));
+      }
+
+      if (x1 - x0 <= subdivision_min_size || y1 - y0 <= subdivision_min_size)
+      {
+        for (size_t y = y0 + 1; y < y1; y++)
+          if (!eval_span(x0 + 1, y, 1, 0, x1 - x0 - 1))
+            return false;
+        return true;
+      }
+
+      size_t xm = (x0 + x1) / 2, ym = (y0 + y1) / 2;
+      return eval_span(x0 + 1, ym, 1, 0, x1 - x0 - 1) && eval_span(xm, y0 + 1, 0, 1, y1 - y0 - 1) &&
+             subdivide(x0, y0, xm, ym) && subdivide(xm, y0, x1, ym) && subdivide(x0, ym, xm, y1) &&
+             subdivide(xm, ym, x1, y1);
+    }
+
+    // all border pixels and already known interior ones are equal
+    bool is_uniform(size_t x0, size_t y0, size_t x1, size_t y1) const
+    {
+      const Pixel value = data[y0 * cols + x0];
+      for (size_t x = x0; x <= x1; x++)
+        if (data[y0 * cols + x] != value || data[y1 * cols + x] != value)
+          return false;
+      for (size_t y = y0 + 1; y < y1; y++)
+        if (data[y * cols + x0] != value || data[y * cols + x1] != value)
+          return false;
+      for (size_t y = y0 + 1; y < y1; y++)
+        for (size_t x = x0 + 1; x < x1; x++)
+          if (is_known(x, y) && data[y * cols + x] != value)
+            return false;
+      return true;
+    }
+
+    const render_job &job;
+    Pixel *data;
+    size_t cols;
+    qreal offset;
+    LineCallback &callback;
+    size_t done = 0;
+    std::array<uint64_t, (size * size + 63) / 64> known{};
+  };
+
   PixelColorGetter func;
-  mutable std::array<pixel_helper::color, size * size * 2> mip_data;
+  std::shared_ptr<const mip_buffer> mip_data;  // level last_mip_level, if rendered
 };
 
+template<class PixelColorGetter, size_t Size, typename Pixel>
+template<class LineCallback>
+auto superpixel<PixelColorGetter, Size, Pixel>::render_job::render(LineCallback &&callback) const
+    -> std::shared_ptr<const mip_buffer>
+{
+  const size_t cols = cols_per_line(mip_level);
+  const qreal offset = grid == sample_grid::NESTED ? 0 : 0.5;
+  const QPointF step(scale / cols, 0);
+  std::shared_ptr<mip_buffer> res = allocate_buffer(mip_level);
+  Pixel *data = res.get();
+  const Pixel *parent_data = parent.get();
+
+  if (mode == render_mode::SUBDIVIDE && cols > subdivision_min_size)
+  {
+    if (!subdivider<LineCallback>(*this, data, parent_data, cols, offset, callback).run())
+      return nullptr;
+    return res;
+  }
+
+  for (size_t y = 0; y < cols; y++)
+  {
+    Pixel *line = data + y * cols;
+    QPointF line_start = ul_corner + QPointF(offset, y + offset) * (scale / cols);
+    if (parent_data != nullptr && y % 2 == 0)
+    {
+      // even samples of even lines are already computed on the coarser level
+      const Pixel *parent_line = parent_data + y / 2 * (cols / 2);
+      Pixel odd[size / 2];
+      get_line(odd, line_start + step, step * 2, cols / 2);
+      for (size_t x = 0; x < cols / 2; x++)
+      {
+        line[2 * x] = parent_line[x];
+        line[2 * x + 1] = odd[x];
+      }
+    }
+    else
+      get_line(line, line_start, step, cols);
+    if (callback())
+      return nullptr;
+  }
+  return res;
+}
+
 template<pixel_helper::color (*Func)(QPointF), size_t Size>
 class superpixel_f : public superpixel<pixel_helper::color (*)(QPointF), Size>
 {
 public:
   superpixel_f() : superpixel<pixel_helper::color (*)(QPointF), Size>(Func) {}
 };
+
+template<void (*Func)(pixel_helper::color *, QPointF, QPointF, size_t), size_t Size>
+class superpixel_row_f : public superpixel<void (*)(pixel_helper::color *, QPointF, QPointF, size_t), Size>
+{
+public:
+  superpixel_row_f() : superpixel<void (*)(pixel_helper::color *, QPointF, QPointF, size_t), Size>(Func) {}
+};
@@ -1,79 +1,172 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
 
-#include "intrusive_list.h"
-
-/* (Multi-thread safe) queue for prioritized tasks */
-template<class T, typename Tag, size_t max_priority>
-class task_queue_ex
+/* (Multi-thread safe) work-stealing queue for prioritized tasks:
+ * every worker owns a deque per priority behind its own small lock, so workers and producers
+ * only contend when they touch the same deque. A worker takes the highest priority task available:
+ * from the front of its own deque, or else stolen from the back of another worker's deque.
+ * Tasks are invalidated lazily: erase only advances the task's ticket, stale entries are dropped on pop. */
+template<class T, size_t max_priority>
+class work_stealing_queue
 {
 public:
   struct store_type : public T
   {
-    bool is_tasked = false;
+    // odd while tasked; every push, pop and erase advances it, so queued entries of older tickets are stale
+    std::atomic<uint64_t> ticket = 0;
+
+    bool is_tasked() const
+    {
+      return ticket.load() & 1;
+    }
   };
 
-  // pre: enclosing mutex is locked
-  bool empty() const;
-  // pre: enclosing mutex is locked, lg is its unique_lock
-  store_type &pop(std::unique_lock<std::mutex> &lg);
-  // pre: enclosing mutex is locked
-  void push(store_type &p);
-  // pre: enclosing mutex is locked
+  static constexpr size_t any_worker = std::numeric_limits<size_t>::max();
+
+  explicit work_stealing_queue(size_t n_workers);
+
+  // pushes p to the worker's own deque, or round-robin for any_worker; retasks p if it is tasked already
+  void push(store_type &p, size_t worker = any_worker);
+  // waits for a task for the worker, the task is not tasked anymore
+  store_type &pop(size_t worker);
+  // invalidates queued p, returns whether it was tasked
   bool erase(store_type &p);
+  // entries of priority prior, including stale ones
+  size_t size(size_t prior) const
+  {
+    return queued[prior].load(std::memory_order_relaxed);
+  }
 
 private:
-  intrusive::list<store_type, Tag> queue[max_priority + 1];
+  struct entry
+  {
+    store_type *task;
+    uint64_t ticket;
+  };
+
+  struct alignas(64) worker_queues
+  {
+    std::mutex m;
+    std::deque<entry> queue[max_priority + 1];
+  };
+
+  store_type *take(size_t worker, size_t prior);
+  store_type *take_from(worker_queues &queues, size_t prior, bool own);
+
+  const size_t n_workers;
+  std::unique_ptr<worker_queues[]> queues;
+  std::atomic<size_t> next_worker = 0;
+  std::atomic<size_t> queued_total = 0;  // entries in all deques, including stale ones
+  std::atomic<size_t> queued[max_priority + 1]{};
+
+  std::mutex sleep_m;
   std::condition_variable cv;
-  mutable size_t cached_non_empty;
+  std::atomic<size_t> sleepers = 0;
 };
 
-template<class T, typename Tag, size_t max_priority>
-bool task_queue_ex<T, Tag, max_priority>::empty() const
+template<class T, size_t max_priority>
+work_stealing_queue<T, max_priority>::work_stealing_queue(size_t n_workers)
+    : n_workers(n_workers), queues(std::make_unique<worker_queues[]>(n_workers))
 {
-  for (size_t i = max_priority + 1; i > 0; i--)
-    if (!queue[i - 1].empty())
-    {
-      cached_non_empty = i - 1;
-      return false;
-    }
-  return true;
 }
 
-// pre: enclosing mutex is locked, lg is its unique_lock
-template<class T, typename Tag, size_t max_priority>
-auto task_queue_ex<T, Tag, max_priority>::pop(std::unique_lock<std::mutex> &lg) -> store_type &
+template<class T, size_t max_priority>
+void work_stealing_queue<T, max_priority>::push(store_type &p, size_t worker)
+{
+  uint64_t ticket = p.ticket.load(), retasked;
+  do
+    retasked = ticket + ((ticket & 1) ? 2 : 1);
+  while (!p.ticket.compare_exchange_weak(ticket, retasked));
+
+  if (worker == any_worker)
+    worker = next_worker.fetch_add(1, std::memory_order_relaxed) % n_workers;
+  size_t prior = p.priority();
+  {
+    std::lock_guard lg(queues[worker].m);
+    queues[worker].queue[prior].push_back({&p, retasked});
+  }
+  queued[prior].fetch_add(1);
+  queued_total.fetch_add(1);
+  if (sleepers.load() > 0)
+  {
+    std::lock_guard lg(sleep_m);
+    cv.notify_one();
+  }
+}
+
+template<class T, size_t max_priority>
+auto work_stealing_queue<T, max_priority>::pop(size_t worker) -> store_type &
 {
-  cv.wait(lg, [this] { return !empty(); });
+  for (;;)
+  {
+    for (size_t i = max_priority + 1; i > 0; i--)
+      if (queued[i - 1].load(std::memory_order_relaxed) != 0)
+        if (store_type *res = take(worker, i - 1))
+          return *res;
 
-  store_type &result = queue[cached_non_empty].front();
-  queue[cached_non_empty].pop_front();
-  result.is_tasked = false;
-  return result;
+    std::unique_lock lg(sleep_m);
+    sleepers.fetch_add(1);
+    cv.wait(lg, [this] { return queued_total.load() != 0; });
+    sleepers.fetch_sub(1);
+  }
 }
 
-// pre: enclosing mutex is locked
-template<class T, typename Tag, size_t max_priority>
-void task_queue_ex<T, Tag, max_priority>::push(store_type &p)
+template<class T, size_t max_priority>
+bool work_stealing_queue<T, max_priority>::erase(store_type &p)
 {
-  queue[p.priority()].push_back(p);
-  p.is_tasked = true;
-  cv.notify_one();
+  uint64_t ticket = p.ticket.load();
+  while (ticket & 1)
+    if (p.ticket.compare_exchange_weak(ticket, ticket + 1))
+      return true;
+  return false;
 }
 
-// pre: enclosing mutex is locked
-template<class T, typename Tag, size_t max_priority>
-bool task_queue_ex<T, Tag, max_priority>::erase(store_type &p)
+template<class T, size_t max_priority>
+auto work_stealing_queue<T, max_priority>::take(size_t worker, size_t prior) -> store_type *
 {
-  if (p.is_tasked)
+  if (store_type *res = take_from(queues[worker], prior, true))
+    return res;
+  for (size_t i = 1; i < n_workers; i++)
+    if (store_type *res = take_from(queues[(worker + i) % n_workers], prior, false))
+      return res;
+  return nullptr;
+}
+
+template<class T, size_t max_priority>
+auto work_stealing_queue<T, max_priority>::take_from(worker_queues &queues, size_t prior, bool own) -> store_type *
+{
+  for (;;)
   {
-    size_t prior = p.priority();
-    queue[prior].erase(queue[prior].iterator_from_el(p));
-    p.is_tasked = false;
-    return true;
+    entry e;
+    {
+      std::lock_guard lg(queues.m);
+      auto &queue = queues.queue[prior];
+      if (queue.empty())
+        return nullptr;
+      if (own)
+      {
+        e = queue.front();
+        queue.pop_front();
+      }
+      else
+      {
+        e = queue.back();
+        queue.pop_back();
+      }
+    }
+    queued[prior].fetch_sub(1);
+    queued_total.fetch_sub(1);
+    // claim the task unless it was erased or pushed again since
+    if (e.task->ticket.compare_exchange_strong(e.ticket, e.ticket + 1))
+      return e.task;
   }
-  return false;
 }
 
 /* (Multi-thread safe) counter waiting for target */
@@ -84,11 +177,14 @@ struct WAITING_COUNTER
   std::condition_variable cv;
 
   // pre: enclosing mutex is locked, lg is its unique_lock
-  void wait(std::unique_lock<std::mutex> &lg, size_t target)
+  // returns false if target is not reached before deadline
+  template<class Clock, class Duration>
+  bool wait_until(std::unique_lock<std::mutex> &lg, size_t target,
+                  const std::chrono::time_point<Clock, Duration> &deadline)
   {
     this->target = target;
     val = 0;
-    cv.wait(lg, [this, target] { return val.load() >= target; });
+    return cv.wait_until(lg, deadline, [this, target] { return val.load() >= target; });
   }
 
   // pre: enclosing mutex is locked, lg is its unique_lock (unlocks)
@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+#include <QDir>
+#include <QSaveFile>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "checksum.h"
+#include "tile_cache.h"
+
+namespace
+{
+  constexpr uint32_t pack_magic = 0x504c544d;    // "MTLP"
+  constexpr uint32_t record_magic = 0x524c544d;  // "MTLR"
+  constexpr uint32_t index_magic = 0x494c544d;   // "MTLI"
+  constexpr uint32_t format_version = 3;  // 2: zoom levels LEVELS_PER_OCTAVE to an octave, 3: tile size in keys
+  // records appended before the index is saved again (bounds the recovery scan)
+  constexpr size_t index_save_interval = 64;
+
+  struct pack_header
+  {
+    uint32_t magic = pack_magic;
+    uint32_t version = format_version;
+    uint64_t generation = 0;
+    uint8_t reserved[48]{};
+  };
+
+  struct record_header
+  {
+    uint32_t magic = record_magic;
+    uint32_t payload_bytes = 0;
+    tile_cache::key k;
+    uint32_t crc = 0;  // of payload_bytes, key and payload
+    uint32_t reserved = 0;
+  };
+
+  struct index_header
+  {
+    uint32_t magic = index_magic;
+    uint32_t version = format_version;
+    uint64_t generation = 0;
+    uint64_t covered_bytes = 0;  // pack prefix described by the index
+    uint64_t count = 0;
+    uint32_t crc = 0;  // of records
+    uint8_t reserved[28]{};
+  };
+
+  struct index_record
+  {
+    tile_cache::key k;
+    uint64_t offset;
+    uint32_t payload_bytes;
+    uint32_t reserved;
+    uint64_t last_used;
+  };
+
+  // payloads stay 64-byte aligned in the pack
+  static_assert(sizeof(pack_header) == 64 && sizeof(record_header) == 64 && sizeof(index_header) == 64);
+
+  uint32_t record_crc(const record_header &h, const void *payload)
+  {
+    uint32_t crc = checksum::crc32(0, &h.payload_bytes, sizeof(h.payload_bytes));
+    crc = checksum::crc32(crc, &h.k, sizeof(h.k));
+    return checksum::crc32(crc, payload, h.payload_bytes);
+  }
+
+  uint64_t new_generation()
+  {
+    std::random_device rd;
+    return (uint64_t(rd()) << 32 ^ rd()) ^
+           static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+  }
+
+  // makes written data durable before the index refers to it
+  void sync(int handle)
+  {
+#if defined(_WIN32)
+    _commit(handle);
+#else
+    fsync(handle);
+#endif
+  }
+
+  void sync(QFileDevice &file)
+  {
+    file.flush();
+    sync(file.handle());
+  }
+}  // namespace
+
+dd_real tile_cache::grid_round(dd_real x, qreal scale)
+{
+  qreal hi = std::round(x.hi / scale);
+  dd_real rest = x - dd_real::two_prod(hi, scale);
+  // -0 and +0 are the same tile
+  return dd_real::two_sum(hi, std::round(static_cast<qreal>(rest) / scale) + 0.0);
+}
+
+dd_real tile_cache::grid_floor(dd_real x, qreal scale)
+{
+  qreal hi = std::floor(x.hi / scale);
+  dd_real rest = x - dd_real::two_prod(hi, scale);
+  return dd_real::two_sum(hi, std::floor(static_cast<qreal>(rest) / scale) + 0.0);
+}
+
+size_t tile_cache::key_hash::operator()(const key &k) const
+{
+  uint64_t parts[] = {uint64_t(uint32_t(k.zoom_level)) << 32 | uint32_t(k.max_iterations),
+                      uint64_t(k.tile_size) << 32 | k.formula};
+  uint64_t res = 0;
+  auto mix = [&res](uint64_t v) { res = (res ^ v) * 0x100000001B3ull + (res >> 29); };
+  for (uint64_t v : parts)
+    mix(v);
+  for (double d : {k.x.hi, k.x.lo, k.y.hi, k.y.lo})
+  {
+    uint64_t v;
+    std::memcpy(&v, &d, sizeof(v));
+    mix(v);
+  }
+  return static_cast<size_t>(res);
+}
+
+tile_cache::tile_cache(const QString &dir, uint64_t budget_bytes)
+    : pack_path(QDir(dir).filePath("tiles.pack")), index_path(QDir(dir).filePath("tiles.idx")),
+      budget_bytes(budget_bytes)
+{
+  if (!QDir().mkpath(dir))
+    return;
+  if (!open_pack(false) && !open_pack(true))
+    return;
+  is_open = true;
+
+  recover(load_index());
+  maintainer = std::thread([this] { maintain(); });
+}
+
+tile_cache::~tile_cache()
+{
+  {
+    std::lock_guard lg(m);
+    is_quitting = true;
+  }
+  maintenance_cv.notify_one();
+  if (maintainer.joinable())
+    maintainer.join();
+
+  std::unique_lock lg(m);
+  if (!is_open)
+    return;
+  save_index(lg);  // keeps LRU stamps of this run
+  unmap();
+  pack.close();
+}
+
+void tile_cache::maintain()
+{
+  std::unique_lock lg(m);
+  for (;;)
+  {
+    maintenance_cv.wait(lg, [this] { return is_quitting || is_compaction_due || is_index_save_due; });
+    if (is_quitting || !is_open)
+      return;
+    if (is_compaction_due)
+    {
+      compact(lg);
+      // the rewrite covers the stores during it, a failed one is retried on the next store
+      is_compaction_due = false;
+    }
+    else
+    {
+      is_index_save_due = false;
+      save_index(lg);
+    }
+  }
+}
+
+bool tile_cache::open_pack(bool create)
+{
+  unmap();
+  pack.close();
+  pack.setFileName(pack_path);
+  if (create)
+  {
+    if (!pack.open(QIODevice::ReadWrite | QIODevice::Truncate))
+      return false;
+    pack_header h;
+    h.generation = generation = new_generation();
+    if (pack.write(reinterpret_cast<const char *>(&h), sizeof(h)) != sizeof(h))
+      return false;
+    sync(pack);
+    pack_bytes = sizeof(h);
+    index.clear();
+    QFile::remove(index_path);
+    return true;
+  }
+
+  if (!pack.open(QIODevice::ReadWrite))
+    return false;
+  pack_header h;
+  if (pack.read(reinterpret_cast<char *>(&h), sizeof(h)) != sizeof(h) || h.magic != pack_magic ||
+      h.version != format_version)
+  {
+    pack.close();
+    return false;
+  }
+  generation = h.generation;
+  pack_bytes = pack.size();
+  return true;
+}
+
+uint64_t tile_cache::load_index()
+{
+  const uint64_t none = sizeof(pack_header);
+  index.clear();
+  QFile f(index_path);
+  if (!f.open(QIODevice::ReadOnly))
+    return none;
+
+  index_header h;
+  if (f.read(reinterpret_cast<char *>(&h), sizeof(h)) != sizeof(h) || h.magic != index_magic ||
+      h.version != format_version || h.generation != generation || h.covered_bytes > pack_bytes ||
+      h.covered_bytes < none)
+    return none;
+  std::vector<index_record> records(h.count);
+  qint64 bytes = static_cast<qint64>(records.size() * sizeof(index_record));
+  if (f.read(reinterpret_cast<char *>(records.data()), bytes) != bytes ||
+      checksum::crc32(0, records.data(), records.size() * sizeof(index_record)) != h.crc)
+    return none;
+
+  for (auto &r : records)
+  {
+    if (r.offset + sizeof(record_header) + r.payload_bytes > h.covered_bytes)
+    {
+      index.clear();
+      return none;
+    }
+    index[r.k] = {r.offset, r.payload_bytes, r.last_used};
+    clock = std::max(clock, r.last_used);
+  }
+  return h.covered_bytes;
+}
+
+// pre: m is locked by lg
+void tile_cache::save_index(std::unique_lock<std::mutex> &lg)
+{
+  std::vector<index_record> records;
+  records.reserve(index.size());
+  for (auto &[k, e] : index)
+    records.push_back({k, e.offset, e.payload_bytes, 0, e.last_used});
+
+  index_header h;
+  h.generation = generation;
+  h.covered_bytes = pack_bytes;
+  h.count = records.size();
+  h.crc = checksum::crc32(0, records.data(), records.size() * sizeof(index_record));
+  const size_t saved_records = unsaved_records;
+
+  // appends go on meanwhile, past the prefix the index covers; only this thread closes the pack
+  pack.flush();
+  const int handle = pack.handle();
+  lg.unlock();
+  sync(handle);
+  QSaveFile f(index_path);
+  bool is_saved = f.open(QIODevice::WriteOnly);
+  if (is_saved)
+  {
+    f.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    f.write(reinterpret_cast<const char *>(records.data()), static_cast<qint64>(records.size() * sizeof(index_record)));
+    is_saved = f.commit();
+  }
+  lg.lock();
+  if (is_saved)
+    unsaved_records -= std::min(unsaved_records, saved_records);
+}
+
+// pre: m is locked
+void tile_cache::recover(uint64_t offset)
+{
+  size_t recovered = 0;
+  while (offset + sizeof(record_header) <= pack_bytes)
+  {
+    const uchar *p = mapped(offset, sizeof(record_header));
+    if (p == nullptr)
+      break;
+    record_header h;
+    std::memcpy(&h, p, sizeof(h));
+    if (h.magic != record_magic || offset + sizeof(h) + h.payload_bytes > pack_bytes)
+      break;
+    p = mapped(offset, sizeof(h) + h.payload_bytes);
+    if (p == nullptr || record_crc(h, p + sizeof(h)) != h.crc)
+      break;
+    index[h.k] = {offset, h.payload_bytes, ++clock};
+    offset += sizeof(h) + h.payload_bytes;
+    recovered++;
+  }
+
+  const bool is_torn = offset != pack_bytes;
+  if (is_torn)
+  {
+    unmap();
+    pack.resize(static_cast<qint64>(offset));
+    pack_bytes = offset;
+  }
+  // saved by the maintenance thread
+  if (recovered > 0 || is_torn)
+    is_index_save_due = true;
+}
+
+// pre: m is locked by lg
+void tile_cache::compact(std::unique_lock<std::mutex> &lg)
+{
+  // records of the prefix appended so far never change until the pack is swapped, by this thread only,
+  // so they are copied through a map of their own with the lock released
+  std::vector<std::pair<key, entry>> by_use(index.begin(), index.end());
+  const uint64_t copied_bytes = pack_bytes;
+  lg.unlock();
+  std::sort(by_use.begin(), by_use.end(),
+            [](auto &a, auto &b) { return a.second.last_used > b.second.last_used; });
+
+  QFile old_pack(pack_path);
+  const uchar *src = old_pack.open(QIODevice::ReadOnly) ? old_pack.map(0, static_cast<qint64>(copied_bytes)) : nullptr;
+  QSaveFile f(pack_path);
+  if (src == nullptr || !f.open(QIODevice::WriteOnly))
+  {
+    lg.lock();
+    return;
+  }
+  pack_header h;
+  h.generation = new_generation();
+  f.write(reinterpret_cast<const char *>(&h), sizeof(h));
+
+  // leave room to grow before the next compaction
+  const uint64_t target = budget_bytes / 4 * 3;
+  std::unordered_map<key, entry, key_hash> kept;
+  uint64_t offset = sizeof(h);
+  for (auto &[k, e] : by_use)
+  {
+    uint64_t size = sizeof(record_header) + e.payload_bytes;
+    if (offset + size > target)
+      break;
+    if (f.write(reinterpret_cast<const char *>(src + e.offset), static_cast<qint64>(size)) != qint64(size))
+    {
+      lg.lock();
+      return;
+    }
+    kept[k] = {offset, e.payload_bytes, e.last_used};
+    offset += size;
+  }
+  old_pack.unmap(const_cast<uchar *>(src));
+  old_pack.close();
+  sync(f);  // commit only syncs the records appended meanwhile
+
+  lg.lock();
+  // records appended meanwhile follow, stamps of lookups meanwhile are kept, records dropped meanwhile are dropped
+  for (auto it = kept.begin(); it != kept.end();)
+  {
+    auto cur = index.find(it->first);
+    if (cur == index.end())
+      it = kept.erase(it);
+    else
+    {
+      it->second.last_used = cur->second.last_used;
+      ++it;
+    }
+  }
+  for (auto &[k, e] : index)
+  {
+    if (e.offset < copied_bytes)
+      continue;
+    uint64_t size = sizeof(record_header) + e.payload_bytes;
+    const uchar *p = mapped(e.offset, size);
+    if (p == nullptr || f.write(reinterpret_cast<const char *>(p), static_cast<qint64>(size)) != qint64(size))
+      return;
+    kept[k] = {offset, e.payload_bytes, e.last_used};
+    offset += size;
+  }
+
+  unmap();
+  pack.close();
+  if (!f.commit())
+  {
+    if (!open_pack(false))
+      is_open = false;
+    return;
+  }
+  if (!open_pack(false))
+  {
+    is_open = false;
+    return;
+  }
+  index = std::move(kept);
+  save_index(lg);
+}
+
+// pre: m is locked
+const uchar *tile_cache::mapped(uint64_t offset, uint64_t bytes)
+{
+  if (offset + bytes > map_bytes)
+  {
+    unmap();
+    map = pack.map(0, static_cast<qint64>(pack_bytes));
+    if (map == nullptr)
+      return nullptr;
+    map_bytes = pack_bytes;
+  }
+  return map + offset;
+}
+
+// pre: m is locked
+void tile_cache::unmap()
+{
+  if (map != nullptr)
+    pack.unmap(map);
+  map = nullptr;
+  map_bytes = 0;
+}
+
+bool tile_cache::load(const key &k, void *out, size_t bytes)
+{
+  std::unique_lock lg(m, std::try_to_lock);
+  if (!lg.owns_lock() || !is_open)
+    return false;
+  auto it = index.find(k);
+  if (it == index.end() || it->second.payload_bytes != bytes)
+    return false;
+
+  const uchar *p = mapped(it->second.offset, sizeof(record_header) + bytes);
+  if (p == nullptr)
+    return false;
+  record_header h;
+  std::memcpy(&h, p, sizeof(h));
+  if (h.magic != record_magic || h.k != k)
+  {
+    index.erase(it);
+    return false;
+  }
+  std::memcpy(out, p + sizeof(h), bytes);
+  it->second.last_used = ++clock;
+  const uint64_t offset = it->second.offset;
+  lg.unlock();
+
+  // checked on the copy, with the lock released: a record damaged on disk is dropped, by a later lookup if busy
+  if (record_crc(h, out) == h.crc)
+    return true;
+  if (!lg.try_lock())
+    return false;
+  it = index.find(k);
+  if (it != index.end() && it->second.offset == offset)
+    index.erase(it);
+  return false;
+}
+
+void tile_cache::store(const key &k, const void *data, size_t bytes)
+{
+  std::lock_guard lg(m);
+  if (!is_open || index.count(k) != 0)
+    return;
+
+  record_header h;
+  h.payload_bytes = static_cast<uint32_t>(bytes);
+  h.k = k;
+  h.crc = record_crc(h, data);
+  if (!pack.seek(static_cast<qint64>(pack_bytes)) ||
+      pack.write(reinterpret_cast<const char *>(&h), sizeof(h)) != sizeof(h) ||
+      pack.write(static_cast<const char *>(data), static_cast<qint64>(bytes)) != qint64(bytes) || !pack.flush())
+  {
+    // out of disk space or similar: drop the partial record
+    unmap();
+    pack.resize(static_cast<qint64>(pack_bytes));
+    return;
+  }
+  index[k] = {pack_bytes, h.payload_bytes, ++clock};
+  pack_bytes += sizeof(h) + bytes;
+
+  // left to the maintenance thread
+  if (pack_bytes > budget_bytes)
+    is_compaction_due = true;
+  else if (++unsaved_records >= index_save_interval)
+    is_index_save_due = true;
+  else
+    return;
+  maintenance_cv.notify_one();
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <QFile>
+#include <QString>
+
+#include "double_double.h"
+
+/* Persistent cache of finished superpixels (finest mip level), kept between runs.
+ * Files in the cache directory:
+ *  - tiles.pack: header, then append-only records (header with key, size and CRC-32, then payload),
+ *    read through a memory map;
+ *  - tiles.idx: key -> record offset and LRU stamp for a prefix of the pack, replaced atomically.
+ * On open, records past the indexed prefix are recovered by scanning, up to the first one failing
+ * its CRC (torn by a crash), where the pack is truncated; lookups check the CRC too and drop records
+ * damaged later. When the pack outgrows the byte budget it is rewritten with the most recently used
+ * records only.
+ * Syncing the index and rewriting the pack are done by a maintenance thread with the lock released,
+ * the rewritten pack is swapped in under it; callers only wait for appends and lookups. */
+class tile_cache
+{
+public:
+  /* Tile on the grid of a zoom level, with the settings it was rendered with */
+  struct key
+  {
+    int32_t zoom_level = 0;
+    int32_t max_iterations = 0;
+    uint32_t formula = 0;  // iteration formula and its variant (e.g. smoothing)
+    uint32_t tile_size = 0;  // pixels on a side
+    dd_real x, y;          // upper left corner / tile size, integer
+
+    bool operator==(const key &other) const
+    {
+      return zoom_level == other.zoom_level && max_iterations == other.max_iterations &&
+             formula == other.formula && tile_size == other.tile_size && x.hi == other.x.hi && x.lo == other.x.lo && y.hi == other.y.hi &&
+             y.lo == other.y.lo;
+    }
+    bool operator!=(const key &other) const
+    {
+      return !(*this == other);
+    }
+  };
+
+  struct key_hash
+  {
+    size_t operator()(const key &k) const;
+  };
+
+  // integer nearest to x / scale
+  static dd_real grid_round(dd_real x, qreal scale);
+  // greatest integer not above x / scale
+  static dd_real grid_floor(dd_real x, qreal scale);
+
+  static constexpr uint64_t default_budget_bytes = uint64_t(1) << 30;
+
+  explicit tile_cache(const QString &dir, uint64_t budget_bytes = default_budget_bytes);
+  tile_cache(const tile_cache &) = delete;
+  tile_cache &operator=(const tile_cache &) = delete;
+  ~tile_cache();
+
+  // copies cached tile k of exactly `bytes` bytes to out, returns false on miss (out may be overwritten then);
+  // never waits for the lock: a cache busy with another caller misses
+  bool load(const key &k, void *out, size_t bytes);
+  // appends tile k unless it is cached already
+  void store(const key &k, const void *data, size_t bytes);
+
+private:
+  struct entry
+  {
+    uint64_t offset;  // of record header
+    uint32_t payload_bytes;
+    uint64_t last_used;
+  };
+
+  bool open_pack(bool create);
+  // returns the pack prefix covered by the loaded index
+  uint64_t load_index();
+  // pre: m is locked by lg, unlocked while syncing and writing
+  void save_index(std::unique_lock<std::mutex> &lg);
+  // adds records from `offset` on to the index, truncates the pack at the first invalid one
+  void recover(uint64_t offset);
+  // pre: m is locked by lg, unlocked while rewriting the pack
+  void compact(std::unique_lock<std::mutex> &lg);
+  // body of maintainer
+  void maintain();
+  const uchar *mapped(uint64_t offset, uint64_t bytes);
+  void unmap();
+
+  std::mutex m;
+  const QString pack_path, index_path;
+  const uint64_t budget_bytes;
+  bool is_open = false;
+
+  QFile pack;
+  uint64_t pack_bytes = 0;
+  uint64_t generation = 0;  // changes on every rewrite of the pack, ties the index to it
+  uchar *map = nullptr;
+  uint64_t map_bytes = 0;
+
+  std::unordered_map<key, entry, key_hash> index;
+  uint64_t clock = 0;           // LRU stamp source
+  size_t unsaved_records = 0;   // appended since the index was saved
+
+  std::thread maintainer;
+  std::condition_variable maintenance_cv;
+  bool is_index_save_due = false, is_compaction_due = false, is_quitting = false;
+};
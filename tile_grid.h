@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+/* Window of a 2D grid of tiles kept in a ring buffer (torus): tile (x, y) lives in cell
+ * (x mod capacity_w, y mod capacity_h), so moving the window only drops the tiles leaving it and
+ * creates the ones entering it, the others stay in their cells. Lookup by tile coordinates is O(1).
+ * The grid refers to tiles, their storage is the caller's */
+template<class T>
+class tile_grid
+{
+public:
+  /* Tiles [x0, x1) x [y0, y1) */
+  struct range
+  {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    int width() const
+    {
+      return x1 - x0;
+    }
+    int height() const
+    {
+      return y1 - y0;
+    }
+    bool is_empty() const
+    {
+      return x0 >= x1 || y0 >= y1;
+    }
+    bool contains(int x, int y) const
+    {
+      return x >= x0 && x < x1 && y >= y0 && y < y1;
+    }
+    range intersected(const range &other) const
+    {
+      return {std::max(x0, other.x0), std::max(y0, other.y0), std::min(x1, other.x1), std::min(y1, other.y1)};
+    }
+    // bounding range of both
+    range united(const range &other) const
+    {
+      if (is_empty())
+        return other;
+      if (other.is_empty())
+        return *this;
+      return {std::min(x0, other.x0), std::min(y0, other.y0), std::max(x1, other.x1), std::max(y1, other.y1)};
+    }
+  };
+
+  const range &window() const
+  {
+    return win;
+  }
+
+  // pre: window().contains(x, y)
+  T &at(int x, int y) const
+  {
+    return *cells[cell(x, y)];
+  }
+
+  /* Moves the window to r: drop(T &) is called for the tiles leaving it,
+   * create(int x, int y) -> T & for the ones entering it */
+  template<class Drop, class Create>
+  void move(range r, Drop &&drop, Create &&create)
+  {
+    if (r.is_empty())
+    {
+      clear(drop);
+      return;
+    }
+
+    for (int y = win.y0; y < win.y1; y++)
+      for_row_outside(y, win, r, [&](int x) { drop(at(x, y)); });
+
+    if (r.width() > capacity_w || r.height() > capacity_h)
+      reserve(std::max(r.width(), capacity_w), std::max(r.height(), capacity_h), win.intersected(r));
+
+    const range old = win;
+    win = r;
+    for (int y = r.y0; y < r.y1; y++)
+      for_row_outside(y, r, old, [&](int x) { cells[cell(x, y)] = &create(x, y); });
+  }
+
+  template<class Drop>
+  void clear(Drop &&drop)
+  {
+    for_each([&](int, int, T &tile) { drop(tile); });
+    win = {};
+  }
+
+  // func(int x, int y, T &tile) row by row
+  template<class Func>
+  void for_each(Func &&func) const
+  {
+    for (int y = win.y0; y < win.y1; y++)
+      for (int x = win.x0; x < win.x1; x++)
+        func(x, y, at(x, y));
+  }
+
+private:
+  static int wrap(int v, int n)
+  {
+    int res = v % n;
+    return res < 0 ? res + n : res;
+  }
+
+  size_t cell(int x, int y) const
+  {
+    return size_t(wrap(y, capacity_h)) * capacity_w + wrap(x, capacity_w);
+  }
+
+  // func(x) for the tiles of row y of `in` but not of `out`
+  template<class Func>
+  static void for_row_outside(int y, const range &in, const range &out, Func &&func)
+  {
+    if (y < out.y0 || y >= out.y1 || out.is_empty())
+    {
+      for (int x = in.x0; x < in.x1; x++)
+        func(x);
+      return;
+    }
+    for (int x = in.x0; x < std::min(in.x1, out.x0); x++)
+      func(x);
+    for (int x = std::max(in.x0, out.x1); x < in.x1; x++)
+      func(x);
+  }
+
+  // new capacity, keeping the tiles of `kept`
+  void reserve(int new_w, int new_h, const range &kept)
+  {
+    std::vector<T *> old_cells(size_t(new_w) * new_h, nullptr);
+    old_cells.swap(cells);
+    const int old_w = capacity_w, old_h = capacity_h;
+    capacity_w = new_w, capacity_h = new_h;
+    for (int y = kept.y0; y < kept.y1; y++)
+      for (int x = kept.x0; x < kept.x1; x++)
+        cells[cell(x, y)] = old_cells[size_t(wrap(y, old_h)) * old_w + wrap(x, old_w)];
+  }
+
+  range win;
+  int capacity_w = 1, capacity_h = 1;
+  std::vector<T *> cells = std::vector<T *>(1, nullptr);
+};
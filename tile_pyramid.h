@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <list>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+
+#include "camera.h"
+#include "slab_arena.h"
+#include "tile_cache.h"
+
+/* In-memory LRU of rendered superpixels of all zoom levels, limited by bytes.
+ * Tiles are keyed like the tile cache; zoom levels camera::LEVELS_PER_OCTAVE apart form a quadtree:
+ * tile (x, y) has children (2x + qx, 2y + qy), qx, qy in {0, 1}, on the next octave.
+ * With NESTED sample grids a quadrant of a tile at mip level m holds exactly the samples of its child
+ * at level m + 1, and four children at level m hold the samples of their parent at level m - 1,
+ * so a missing tile is assembled from either without computing anything. */
+template<typename Pixel, size_t Size>
+class tile_pyramid
+{
+public:
+  using key = tile_cache::key;
+  using key_hash = tile_cache::key_hash;
+  using buffer = std::shared_ptr<const Pixel[]>;
+
+  struct tile
+  {
+    buffer data;
+    int mip_level;
+  };
+
+  static constexpr size_t default_budget_bytes = size_t(512) << 20;
+
+  explicit tile_pyramid(size_t budget_bytes = default_budget_bytes) : budget_bytes(budget_bytes) {}
+
+  static size_t tile_bytes(int mip_level)
+  {
+    size_t cols = Size >> mip_level;
+    return slab_arena::block_size(cols * cols * sizeof(Pixel));
+  }
+
+  // keeps t unless a finer level of k is kept already, drops least recently used tiles beyond the budget
+  void put(const key &k, tile t)
+  {
+    auto it = tiles.find(k);
+    if (it != tiles.end())
+    {
+      if (it->second.t.mip_level <= t.mip_level)
+      {
+        touch(it->second);
+        return;
+      }
+      erase(it);
+    }
+    used_bytes += tile_bytes(t.mip_level);
+    lru.push_front(k);
+    tiles.emplace(k, node{std::move(t), lru.begin()});
+
+    while (used_bytes > budget_bytes && !lru.empty())
+      erase(tiles.find(lru.back()));
+  }
+
+  // removes and returns tile k
+  std::optional<tile> take(const key &k)
+  {
+    auto it = tiles.find(k);
+    if (it == tiles.end())
+      return std::nullopt;
+    tile res = std::move(it->second.t);
+    erase(it);
+    return res;
+  }
+
+  /* Assembles tile k at a level not coarser than max_mip_level from its parent or children,
+   * fill(int mip_level, Func &&copy) must provide a buffer for the level and call copy(Pixel *data);
+   * copy keeps the tiles it reads, so it can be kept and called after the pyramid has changed */
+  template<class Fill>
+  bool assemble(const key &k, int max_mip_level, Fill &&fill)
+  {
+    return from_parent(k, max_mip_level, fill) || from_children(k, max_mip_level, fill);
+  }
+
+  size_t bytes() const
+  {
+    return used_bytes;
+  }
+
+private:
+  struct node
+  {
+    tile t;
+    typename std::list<key>::iterator lru_pos;
+  };
+
+  static dd_real floor_half(dd_real x)
+  {
+    x = x * dd_real(0.5);
+    double hi = std::floor(x.hi);
+    return hi == x.hi ? dd_real::two_sum(hi, std::floor(x.lo) + 0.0) : dd_real(hi);
+  }
+
+  const tile *find(const key &k)
+  {
+    auto it = tiles.find(k);
+    if (it == tiles.end())
+      return nullptr;
+    touch(it->second);
+    return &it->second.t;
+  }
+
+  template<class Fill>
+  bool from_parent(const key &k, int max_mip_level, Fill &fill)
+  {
+    key parent_key = k;
+    parent_key.zoom_level -= camera::LEVELS_PER_OCTAVE;
+    parent_key.x = floor_half(k.x);
+    parent_key.y = floor_half(k.y);
+    const tile *parent = find(parent_key);
+    if (parent == nullptr || parent->mip_level + 1 > max_mip_level || (Size >> parent->mip_level) < 2)
+      return false;
+
+    const size_t qx = static_cast<size_t>(static_cast<double>(k.x - parent_key.x * dd_real(2)));
+    const size_t qy = static_cast<size_t>(static_cast<double>(k.y - parent_key.y * dd_real(2)));
+    const size_t parent_cols = Size >> parent->mip_level, cols = parent_cols / 2;
+    const Pixel *src = parent->data.get() + qy * cols * parent_cols + qx * cols;
+    return fill(parent->mip_level + 1, [src, parent_cols, cols, kept = parent->data](Pixel *data) {
+      for (size_t y = 0; y < cols; y++)
+        std::copy(src + y * parent_cols, src + y * parent_cols + cols, data + y * cols);
+    });
+  }
+
+  template<class Fill>
+  bool from_children(const key &k, int max_mip_level, Fill &fill)
+  {
+    std::array<std::array<tile, 2>, 2> children;
+    int coarsest = 0;
+    for (int qy = 0; qy < 2; qy++)
+      for (int qx = 0; qx < 2; qx++)
+      {
+        key child_key = k;
+        child_key.zoom_level += camera::LEVELS_PER_OCTAVE;
+        child_key.x = k.x * dd_real(2) + dd_real(qx);
+        child_key.y = k.y * dd_real(2) + dd_real(qy);
+        const tile *child = find(child_key);
+        if (child == nullptr)
+          return false;
+        children[qy][qx] = *child;
+        coarsest = std::max(coarsest, child->mip_level);
+      }
+
+    // children at level m make up the parent at m - 1, finer children are subsampled
+    const int mip_level = std::max(coarsest - 1, 0);
+    if (mip_level > max_mip_level)
+      return false;
+    const size_t cols = Size >> mip_level, half = cols / 2;
+    return fill(mip_level, [children, cols, half](Pixel *data) {
+      for (int qy = 0; qy < 2; qy++)
+        for (int qx = 0; qx < 2; qx++)
+        {
+          const tile &child = children[qy][qx];
+          const size_t child_cols = Size >> child.mip_level, stride = child_cols / half;
+          for (size_t y = 0; y < half; y++)
+            for (size_t x = 0; x < half; x++)
+              data[(qy * half + y) * cols + qx * half + x] = child.data[y * stride * child_cols + x * stride];
+        }
+    });
+  }
+
+  void touch(node &n)
+  {
+    lru.splice(lru.begin(), lru, n.lru_pos);
+  }
+
+  void erase(typename std::unordered_map<key, node, key_hash>::iterator it)
+  {
+    used_bytes -= tile_bytes(it->second.t.mip_level);
+    lru.erase(it->second.lru_pos);
+    tiles.erase(it);
+  }
+
+  const size_t budget_bytes;
+  size_t used_bytes = 0;
+  std::list<key> lru;  // most recently used first
+  std::unordered_map<key, node, key_hash> tiles;
+};
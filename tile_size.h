@@ -0,0 +1,48 @@
+#pragma once
+
+#include <type_traits>
+#include <QString>
+
+/* Superpixel sizes selectable at startup: classes templated on the size are instantiated for every
+ * size_pow of [min_pow, max_pow] (64 to 512 pixels), dispatch picks the instantiation at runtime */
+namespace tile_size
+{
+  constexpr int min_pow = 6;
+  constexpr int max_pow = 9;
+  constexpr int default_pow = 8;
+
+  inline bool is_valid(int size_pow)
+  {
+    return size_pow >= min_pow && size_pow <= max_pow;
+  }
+
+  // returns func(std::integral_constant<int, size_pow>()), the result type must not depend on size_pow
+  // pre: is_valid(size_pow)
+  template<class Func>
+  decltype(auto) dispatch(int size_pow, Func &&func)
+  {
+    static_assert(min_pow == 6 && max_pow == 9, "a case for every size");
+    switch (size_pow)
+    {
+    case 6:
+      return func(std::integral_constant<int, 6>());
+    case 7:
+      return func(std::integral_constant<int, 7>());
+    case 9:
+      return func(std::integral_constant<int, 9>());
+    default:
+      return func(std::integral_constant<int, 8>());
+    }
+  }
+
+  // size_pow of a size in pixels ("64" to "512"), -1 for anything else
+  inline int parse(const QString &text)
+  {
+    bool ok = false;
+    const int size = text.toInt(&ok);
+    for (int size_pow = min_pow; ok && size_pow <= max_pow; size_pow++)
+      if (size == 1 << size_pow)
+        return size_pow;
+    return -1;
+  }
+}  // namespace tile_size
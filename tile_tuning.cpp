@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "superpixel.h"
+#include "task_queue.h"
+#include "tile_tuning.h"
+
+namespace
+{
+  using clock = std::chrono::steady_clock;
+
+  template<int SizePow>
+  struct screen_tile_base : superpixel<view_kernel, size_t(1) << SizePow, float>
+  {
+    // coarser levels first, as the viewer takes them
+    size_t priority()
+    {
+      return this->last_mip_level - 1;
+    }
+
+    bool is_quit = false;
+  };
+
+  // seconds to render the screen as the viewer does
+  template<int SizePow>
+  double render_screen(QSize screen, unsigned n_threads, const view_kernel &kernel, qreal pixel_scale)
+  {
+    constexpr int size = 1 << SizePow;
+    using queue_t = work_stealing_queue<screen_tile_base<SizePow>, SizePow>;
+    using tile = typename queue_t::store_type;
+
+    // the screen starts in the middle of a superpixel, as it does on average
+    const int cols = (screen.width() + size / 2 + size - 1) / size;
+    const int rows = (screen.height() + size / 2 + size - 1) / size;
+    const size_t n_tiles = size_t(cols) * rows;
+    auto tiles = std::make_unique<tile[]>(n_tiles);
+    for (int r = 0; r < rows; r++)
+      for (int c = 0; c < cols; c++)
+      {
+        tile &t = tiles[size_t(r) * cols + c];
+        t.ul_corner = QPointF(c * size - size / 2 - screen.width() / 2., r * size - size / 2 - screen.height() / 2.) *
+                      pixel_scale;
+        t.scale = size * pixel_scale;
+        t.grid = tile::sample_grid::NESTED;
+        t.mode = tile::render_mode::SUBDIVIDE;
+        t.set_func(kernel);
+        t.set_mip_level(SizePow);
+      }
+
+    queue_t queue(n_threads);
+    std::mutex m;
+    std::condition_variable cv;
+    size_t remaining = n_tiles;  // tiles without the finest level
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < n_threads; i++)
+      workers.emplace_back([&, i] {
+        for (;;)
+        {
+          tile &t = queue.pop(i);
+          if (t.is_quit)
+            break;
+          auto job = t.next_job();
+          t.publish(job, job.render([] { return false; }));
+          if (job.mip_level != 0)
+            queue.push(t, i);
+          else
+          {
+            std::lock_guard lg(m);
+            if (--remaining == 0)
+              cv.notify_one();
+          }
+        }
+      });
+
+    const auto begin = clock::now();
+    for (size_t i = 0; i < n_tiles; i++)
+      queue.push(tiles[i]);
+    {
+      std::unique_lock lg(m);
+      cv.wait(lg, [&remaining] { return remaining == 0; });
+    }
+    const double seconds = std::chrono::duration<double>(clock::now() - begin).count();
+
+    auto quit = std::make_unique<tile[]>(n_threads);
+    for (unsigned i = 0; i < n_threads; i++)
+    {
+      quit[i].is_quit = true;
+      quit[i].set_mip_level(SizePow);
+      queue.push(quit[i]);
+    }
+    for (auto &th : workers)
+      th.join();
+    return seconds;
+  }
+}  // namespace
+
+std::vector<tile_tuning::result> tile_tuning::measure_screen(QSize screen, unsigned n_threads, int runs)
+{
+  // the whole set, as the viewer starts
+  const qreal pixel_scale = 3. / std::max(screen.width(), 1);
+  const view_kernel kernel = view_kernel::create(kernel_tiers(), -0.5, 0, pixel_scale, escape_time::settings());
+  const double pixels = double(screen.width()) * screen.height();
+
+  std::vector<result> res;
+  for (int size_pow = tile_size::min_pow; size_pow <= tile_size::max_pow; size_pow++)
+  {
+    double best = std::numeric_limits<double>::max();
+    for (int run = 0; run < runs; run++)
+      best = std::min(best, tile_size::dispatch(size_pow, [&](auto sp) {
+        return render_screen<decltype(sp)::value>(screen, n_threads, kernel, pixel_scale);
+      }));
+    res.push_back({size_pow, best, pixels / best});
+  }
+  return res;
+}
+
+std::vector<tile_tuning::result> tile_tuning::measure_image(offline_renderer &renderer, offline_renderer::view v,
+                                                            int runs)
+{
+  v.width = std::min(v.width, sample_width);
+  v.height = std::min(v.height, sample_height);
+  const double pixels = double(v.width) * v.height;
+
+  std::vector<result> res;
+  for (int size_pow = tile_size::min_pow; size_pow <= tile_size::max_pow; size_pow++)
+  {
+    renderer.set_tile_size_pow(size_pow);
+    double best = std::numeric_limits<double>::max();
+    for (int run = 0; run < runs; run++)
+    {
+      const auto begin = clock::now();
+      renderer.render(v, [](const float *, int) { return true; });
+      best = std::min(best, std::chrono::duration<double>(clock::now() - begin).count());
+    }
+    res.push_back({size_pow, best, pixels / best});
+  }
+  return res;
+}
+
+int tile_tuning::pick(const std::vector<result> &results)
+{
+  return std::min_element(results.begin(), results.end(),
+                          [](const result &a, const result &b) { return a.seconds < b.seconds; })
+      ->size_pow;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+#include <QSize>
+
+#include "offline_renderer.h"
+
+/* Measured choice of the superpixel size (see tile_size.h) for the core count and the screen or image size:
+ * larger superpixels have less overhead per pixel, smaller ones keep more workers busy on small screens
+ * and render less outside of the screen border */
+namespace tile_tuning
+{
+  struct result
+  {
+    int size_pow;
+    double seconds;       // to the whole screen (image) at the finest mip level, the best of the runs
+    double pixels_per_s;  // of the screen (image)
+  };
+
+  // the viewer's overview of the set on a screen of the given size on n_threads: all of its superpixels
+  // are queued at once and rendered from the coarsest mip level, every level a task of its own
+  std::vector<result> measure_screen(QSize screen, unsigned n_threads, int runs = 2);
+
+  // image sample rendered by renderer: the center of v, at most sample_width x sample_height pixels
+  constexpr int sample_width = 4096, sample_height = 1024;
+  // every size is measured on a sample of v; renderer is left with the last size
+  std::vector<result> measure_image(offline_renderer &renderer, offline_renderer::view v, int runs = 2);
+
+  // size_pow of the shortest time, pre: !results.empty()
+  int pick(const std::vector<result> &results);
+}  // namespace tile_tuning
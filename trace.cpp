@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <QFile>
+
+#include "trace.h"
+
+namespace
+{
+  struct name_info
+  {
+    const char *name;
+    const char *category;
+  };
+
+  constexpr name_info names[size_t(trace::event::COUNT)] = {
+      {"queued", "tile"},
+      {"render", "tile"},
+      {"cancelled", "tile"},
+      {"published", "tile"},
+      {"update screen", "gui"},
+      {"paint", "gui"},
+      {"superpixel bytes", "memory"},
+      {"pyramid bytes", "memory"},
+      {"arena bytes", "memory"},
+  };
+
+  /* Event as written by its thread: relaxed atomic words, so the exporter may read them while they are written
+   * and drop the ones overwritten during the read (see export_events) */
+  struct slot
+  {
+    std::atomic<uint64_t> ns;
+    std::atomic<uint64_t> id;
+    std::atomic<uint64_t> packed;  // arg, event << 32, phase << 40
+  };
+
+  struct thread_buffer
+  {
+    std::string name;
+    int tid;
+    std::atomic<uint64_t> claimed = 0;    // events started to be written
+    std::atomic<uint64_t> committed = 0;  // events written
+    std::unique_ptr<slot[]> ring = std::make_unique<slot[]>(trace::buffer_events);
+  };
+
+  struct trace_event
+  {
+    uint64_t ns, id;
+    int32_t arg;
+    trace::event e;
+    trace::phase ph;
+  };
+
+  const auto epoch = std::chrono::steady_clock::now();
+  std::atomic<uint64_t> start_ns = 0;
+
+  std::mutex buffers_m;
+  std::vector<std::unique_ptr<thread_buffer>> buffers;  // kept after their threads exit
+
+  thread_local std::string thread_name;
+  thread_local thread_buffer *local_buffer = nullptr;
+
+  uint64_t now_ns()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+  }
+
+  thread_buffer &get_local_buffer()
+  {
+    if (local_buffer == nullptr)
+    {
+      std::lock_guard lg(buffers_m);
+      buffers.push_back(std::make_unique<thread_buffer>());
+      local_buffer = buffers.back().get();
+      local_buffer->tid = static_cast<int>(buffers.size());
+      local_buffer->name = thread_name.empty() ? "thread " + std::to_string(buffers.size()) : thread_name;
+    }
+    return *local_buffer;
+  }
+
+  // pre: buffers_m is locked
+  // events of b since `since_ns`, except the ones its thread overwrote while they were read
+  std::vector<trace_event> export_events(const thread_buffer &b, uint64_t since_ns)
+  {
+    const uint64_t committed = b.committed.load(std::memory_order_acquire);
+    uint64_t first = committed > trace::buffer_events ? committed - trace::buffer_events : 0;
+    std::vector<trace_event> res;
+    res.reserve(committed - first);
+    for (uint64_t i = first; i < committed; i++)
+    {
+      const slot &s = b.ring[i & (trace::buffer_events - 1)];
+      uint64_t packed = s.packed.load(std::memory_order_relaxed);
+      res.push_back({s.ns.load(std::memory_order_relaxed), s.id.load(std::memory_order_relaxed),
+                     static_cast<int32_t>(packed), static_cast<trace::event>(packed >> 32 & 0xFF),
+                     static_cast<trace::phase>(packed >> 40 & 0xFF)});
+    }
+
+    // slots of events claimed meanwhile could be overwritten during the read
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t claimed = b.claimed.load(std::memory_order_relaxed);
+    const uint64_t valid_first = claimed > trace::buffer_events ? claimed - trace::buffer_events : 0;
+    res.erase(res.begin(), res.begin() + static_cast<ptrdiff_t>(std::min(std::max(valid_first, first), committed) - first));
+    res.erase(std::remove_if(res.begin(), res.end(), [since_ns](const trace_event &ev) { return ev.ns < since_ns; }),
+              res.end());
+    return res;
+  }
+
+  void append_event(std::string &out, int tid, const trace_event &ev)
+  {
+    const name_info &info = names[size_t(ev.e)];
+    static constexpr char phases[] = {'B', 'E', 'i', 'C'};
+    char buf[256];
+    int n = std::snprintf(buf, sizeof(buf), "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+                          info.name, info.category, phases[size_t(ev.ph)], ev.ns / 1e3, tid);
+    out.append(buf, n);
+    if (ev.ph == trace::phase::COUNTER)
+      n = std::snprintf(buf, sizeof(buf), ",\"args\":{\"value\":%" PRIu64 "}}", ev.id);
+    else if (ev.id != 0)
+      n = std::snprintf(buf, sizeof(buf), "%s,\"args\":{\"id\":\"0x%" PRIx64 "\",\"arg\":%d}}",
+                        ev.ph == trace::phase::INSTANT ? ",\"s\":\"t\"" : "", ev.id, ev.arg);
+    else
+      n = std::snprintf(buf, sizeof(buf), "%s}", ev.ph == trace::phase::INSTANT ? ",\"s\":\"t\"" : "");
+    out.append(buf, n);
+  }
+}  // namespace
+
+void trace::record(event e, phase ph, uint64_t id, int32_t arg)
+{
+  thread_buffer &b = get_local_buffer();
+  const uint64_t i = b.claimed.load(std::memory_order_relaxed);
+  b.claimed.store(i + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot &s = b.ring[i & (buffer_events - 1)];
+  s.ns.store(now_ns(), std::memory_order_relaxed);
+  s.id.store(id, std::memory_order_relaxed);
+  s.packed.store(static_cast<uint32_t>(arg) | uint64_t(e) << 32 | uint64_t(ph) << 40, std::memory_order_relaxed);
+  b.committed.store(i + 1, std::memory_order_release);
+}
+
+void trace::set_thread_name(const std::string &name)
+{
+  thread_name = name;
+  if (local_buffer != nullptr)
+  {
+    std::lock_guard lg(buffers_m);
+    local_buffer->name = name;
+  }
+}
+
+void trace::start()
+{
+  start_ns = now_ns();
+  enabled = true;
+}
+
+void trace::stop()
+{
+  enabled = false;
+}
+
+bool trace::dump(const QString &path)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool ok = true;
+  std::lock_guard lg(buffers_m);
+  for (auto &b : buffers)
+  {
+    out += (b == buffers.front() ? "\n" : ",\n");
+    out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(b->tid) +
+           ",\"args\":{\"name\":\"" + b->name + "\"}}";
+    for (const trace_event &ev : export_events(*b, start_ns))
+    {
+      out += ",\n";
+      append_event(out, b->tid, ev);
+      if (out.size() >= (size_t(1) << 20))
+      {
+        ok = ok && file.write(out.data(), out.size()) == qint64(out.size());
+        out.clear();
+      }
+    }
+  }
+  out += "\n]}\n";
+  ok = ok && file.write(out.data(), out.size()) == qint64(out.size());
+  return ok;
+}
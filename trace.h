@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <QString>
+
+/* Runtime tracing: events are recorded into a ring buffer of the calling thread without locks or formatting,
+ * and exported in Chrome trace_event JSON (chrome://tracing, ui.perfetto.dev).
+ * Recording costs one relaxed load while tracing is stopped; a buffer keeps the last
+ * buffer_events events of its thread */
+namespace trace
+{
+  enum class event : uint8_t
+  {
+    TILE_QUEUED,     // instant, arg: mip level to render
+    TILE_RENDER,     // span from starting a mip level to it done, arg: mip level
+    TILE_CANCELLED,  // instant, render dropped for input version mismatch
+    TILE_PUBLISHED,  // instant, arg: mip level
+    UPDATE_SCREEN,   // span of an input change on the GUI thread
+    PAINT,           // span
+    SUPERPIXEL_BYTES,  // counter
+    PYRAMID_BYTES,     // counter
+    ARENA_BYTES,       // counter
+    COUNT
+  };
+
+  enum class phase : uint8_t
+  {
+    BEGIN,
+    END,
+    INSTANT,
+    COUNTER
+  };
+
+  constexpr size_t buffer_events = size_t(1) << 15;  // power of 2
+
+  inline std::atomic<bool> enabled = false;
+
+  // pre: enabled
+  void record(event e, phase ph, uint64_t id, int32_t arg);
+
+  inline bool is_enabled()
+  {
+    return enabled.load(std::memory_order_relaxed);
+  }
+
+  // id names the object of the event (e.g. superpixel address), for counters it is the value
+  inline void instant(event e, uint64_t id = 0, int32_t arg = 0)
+  {
+    if (is_enabled())
+      record(e, phase::INSTANT, id, arg);
+  }
+  inline void begin(event e, uint64_t id = 0, int32_t arg = 0)
+  {
+    if (is_enabled())
+      record(e, phase::BEGIN, id, arg);
+  }
+  inline void end(event e, uint64_t id = 0, int32_t arg = 0)
+  {
+    if (is_enabled())
+      record(e, phase::END, id, arg);
+  }
+  inline void counter(event e, uint64_t value)
+  {
+    if (is_enabled())
+      record(e, phase::COUNTER, value, 0);
+  }
+
+  /* Span of the enclosing scope */
+  class scope
+  {
+  public:
+    scope(event e, uint64_t id = 0, int32_t arg = 0) : e(e), id(id), arg(arg)
+    {
+      begin(e, id, arg);
+    }
+    ~scope()
+    {
+      end(e, id, arg);
+    }
+
+  private:
+    event e;
+    uint64_t id;
+    int32_t arg;
+  };
+
+  // name of the calling thread in exported traces
+  void set_thread_name(const std::string &name);
+
+  // starts recording, events recorded before are not exported
+  void start();
+  void stop();
+
+  // writes events recorded since start() in Chrome trace_event JSON, returns false on I/O error
+  bool dump(const QString &path);
+}  // namespace trace
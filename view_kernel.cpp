@@ -0,0 +1,44 @@
+#include "view_kernel.h"
+
+view_kernel view_kernel::create(const kernel_tiers &tiers, dd_real origin_x, dd_real origin_y, qreal pixel_scale,
+                                const escape_time::settings &settings)
+{
+  return create(tiers.select(pixel_scale), origin_x, origin_y, settings);
+}
+
+view_kernel view_kernel::create(kernel_tier tier, dd_real origin_x, dd_real origin_y,
+                                const escape_time::settings &settings)
+{
+  view_kernel res;
+  res.tier = tier;
+  res.settings = settings;
+  res.origin_x = origin_x;
+  res.origin_y = origin_y;
+  if (res.tier == kernel_tier::PERTURBATION)
+    res.orbit = defer_orbit(origin_x, origin_y, settings);
+  return res;
+}
+
+std::shared_future<reference_orbit> view_kernel::defer_orbit(dd_real origin_x, dd_real origin_y,
+                                                             const escape_time::settings &settings)
+{
+  // deferred: creating a view costs nothing on the caller's thread
+  return std::async(std::launch::deferred, [=] { return reference_orbit(origin_x, origin_y, settings); }).share();
+}
+
+void view_kernel::operator()(float *out, QPointF start, QPointF step, size_t count) const
+{
+  switch (tier)
+  {
+  case kernel_tier::DOUBLE:
+    escape_time::calc_row(out, QPointF(static_cast<qreal>(origin_x), static_cast<qreal>(origin_y)) + start, step,
+                          count, settings);
+    break;
+  case kernel_tier::DOUBLE_DOUBLE:
+    escape_time::calc_row(out, origin_x, origin_y, start, step, count, settings);
+    break;
+  case kernel_tier::PERTURBATION:
+    orbit.get().calc_row(out, start, step, count);
+    break;
+  }
+}
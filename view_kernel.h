@@ -0,0 +1,30 @@
+#pragma once
+
+#include <future>
+#include <QPointF>
+
+#include "double_double.h"
+#include "escape_time.h"
+#include "kernel_tiers.h"
+#include "perturbation.h"
+
+/* Per-view row getter: iterates points around the view origin with the kernel tier picked for its zoom depth */
+struct view_kernel
+{
+  kernel_tier tier = kernel_tier::DOUBLE;
+  escape_time::settings settings;
+  dd_real origin_x, origin_y;
+  std::shared_future<reference_orbit> orbit;  // for kernel_tier::PERTURBATION
+
+  // defers the reference orbit of the origin if the view needs perturbation
+  static view_kernel create(const kernel_tiers &tiers, dd_real origin_x, dd_real origin_y, qreal pixel_scale,
+                            const escape_time::settings &settings);
+  // with the tier picked elsewhere, e.g. by a render farm coordinator for all of its workers
+  static view_kernel create(kernel_tier tier, dd_real origin_x, dd_real origin_y,
+                            const escape_time::settings &settings);
+  // the reference orbit of the origin, computed by the first row getting it while the others wait
+  static std::shared_future<reference_orbit> defer_orbit(dd_real origin_x, dd_real origin_y,
+                                                         const escape_time::settings &settings);
+
+  void operator()(float *out, QPointF start, QPointF step, size_t count) const;
+};